@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ *
+ * Hot /proc and /sys attributes are opened once, and re-read with pread()
+ * into a preallocated buffer, rather than open/read/close on every poll.
+ * A descriptor gone stale (device removed, driver rebound) is reopened.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "attr-reader.h"
+#include "attr-uring.h"
+
+
+/* read groups through io_uring, where available */
+static bool attr_batch = false;
+
+void attr_reader_set_batch(bool enable)
+{
+	attr_batch = enable;
+}
+
+
+AttrGroup *attr_group_create(int max)
+{
+	AttrGroup *g;
+
+	g = (AttrGroup *)calloc(1, sizeof(AttrGroup) + (sizeof(Attr) * max));
+	if ( !g ) {
+		sloge("attr-reader: could not allocate memory");
+		return NULL;
+	}
+
+	g->max = max;
+	return g;
+}
+
+void attr_group_destroy(AttrGroup *g)
+{
+	int i;
+
+	if (g == NULL)
+		return;
+
+	attr_ring_destroy(g->ring);
+	for (i = 0; i < g->count; ++i) {
+		if (g->attr[i].fd >= 0)
+			close(g->attr[i].fd);
+		free(g->attr[i].buf);
+	}
+
+	free(g);
+}
+
+static int attr_open(Attr *a)
+{
+	a->fd = open(a->path, O_RDONLY | O_CLOEXEC);
+	if (a->fd < 0)
+		return -errno;
+
+	return 0;
+}
+
+static void attr_close(Attr *a)
+{
+	if (a->fd >= 0)
+		close(a->fd);
+	a->fd = -1;
+}
+
+/*
+ * Add an attribute with an initial buffer of 'size' bytes (grown as needed).
+ * The attribute is opened right away if possible, otherwise upon read.
+ * Return:
+ * attribute index in the group, or -errno
+ */
+int attr_group_add(AttrGroup *g, const char *path, size_t size)
+{
+	Attr *a;
+
+	if (g->count >= g->max)
+		return -ENOSPC;
+
+	if (strlen(path) >= ATTR_PATH_SIZE)
+		return -ENAMETOOLONG;
+
+	a = &g->attr[g->count];
+	a->buf = (char *)malloc(size);
+	if (a->buf == NULL)
+		return -ENOMEM;
+
+	strcpy(a->path, path);
+	a->sysfs = !strncmp(path, "/sys/", 5);
+	a->size = size;
+	a->len = -ENODATA;
+	a->buf[0] = '\0';
+	if (attr_open(a))
+		slogi("%s: could not open: %m", path);
+
+	return g->count++;
+}
+
+/*
+ * Read the whole attribute into its buffer, '\0' terminated.
+ * Return:
+ * the number of bytes read, or -errno
+ */
+int attr_read(Attr *a)
+{
+	size_t len;
+	ssize_t n;
+	char *buf;
+	int retry;
+	int err = 0;
+
+	for (retry = 0; retry < 2; ++retry) {
+		if ((a->fd < 0) && ((err = attr_open(a)) < 0))
+			break;
+
+		len = 0;
+		while ((n = pread(a->fd, a->buf + len, a->size - 1 - len, len)) > 0) {
+			len += n;
+			if (len < a->size - 1) {
+				/* the end of a sysfs attribute; a seq_file returns about a page per read */
+				if (a->sysfs) {
+					n = 0;
+					break;
+				}
+				continue;
+			}
+
+			/* out of room: happens once, until the buffer fits */
+			buf = (char *)realloc(a->buf, a->size * 2);
+			if (buf == NULL) {
+				n = 0;
+				break;
+			}
+			a->buf = buf;
+			a->size *= 2;
+		}
+
+		if (n == 0) {
+			a->buf[len] = '\0';
+			a->len = len;
+			return len;
+		}
+
+		err = -errno;
+		if ((err != -ENODEV) && (err != -ESTALE))
+			break;
+
+		/* the attribute has been re-created: reopen */
+		attr_close(a);
+	}
+
+	a->buf[0] = '\0';
+	a->len = err;
+	return err;
+}
+
+/*
+ * Read each attribute in the group, in a single batch if enabled and supported.
+ * Return:
+ * the number of attributes read successfully
+ */
+int attr_group_read(AttrGroup *g)
+{
+	int ok = 0;
+	int i;
+
+	if (attr_batch && !g->ring_failed) {
+		if (g->ring == NULL)
+			g->ring = attr_ring_create(g->max);
+
+		if (g->ring != NULL) {
+			ok = attr_ring_read_group(g->ring, g);
+			if (ok >= 0)
+				return ok;
+
+			slogw("io_uring: batched read failed: %s: falling back to pread", strerror(-ok));
+			attr_ring_destroy(g->ring);
+			g->ring = NULL;
+		}
+
+		g->ring_failed = true;
+		ok = 0;
+	}
+
+	for (i = 0; i < g->count; ++i) {
+		if (attr_read(&g->attr[i]) >= 0)
+			++ok;
+	}
+
+	return ok;
+}
+
+/*
+ * Parse the last read attribute value as an integer.
+ */
+int attr_parse_long(Attr *a, long *value)
+{
+	char *end;
+
+	if (a->len <= 0)
+		return (a->len < 0) ? (int)a->len : -ENODATA;
+
+	*value = strtol(a->buf, &end, 0);
+	if (end == a->buf)
+		return -EINVAL;
+
+	return 0;
+}
+
+
+/* unit test */
+int attr_reader_test(void)
+{
+	char path[] = "/tmp/attr-reader-XXXXXX";
+	const char *long_value = "123456789 123456789 123456789 123456789";
+	AttrGroup *g;
+	long value = 0;
+	int len;
+	int fd;
+	int i;
+	int err = 0;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	unlink(path);
+	fd = -1;
+
+	g = attr_group_create(2);
+
+	/* not there yet: opened upon read */
+	i = attr_group_add(g, path, 4);
+	if ((i != 0) || (attr_read(&g->attr[i]) != -ENOENT)) {
+		err = -2;
+		goto test_out;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (write(fd, "42\n", 3) != 3) {
+		err = -3;
+		goto test_out;
+	}
+
+	if ((attr_group_read(g) != 1) || attr_parse_long(&g->attr[0], &value) || (value != 42)) {
+		err = -4;
+		goto test_out;
+	}
+
+	/* the same descriptor sees the new contents; the buffer grows */
+	if (pwrite(fd, long_value, strlen(long_value), 0) != strlen(long_value)) {
+		err = -5;
+		goto test_out;
+	}
+
+	if ((attr_read(&g->attr[0]) != strlen(long_value)) || strcmp(g->attr[0].buf, long_value)) {
+		err = -6;
+		goto test_out;
+	}
+
+	/* batched, or falling back to pread() where io_uring is not available */
+	attr_reader_set_batch(true);
+	/* a regular file ends at a short read too: let the ring take it */
+	g->attr[0].sysfs = true;
+	if ((attr_group_read(g) != 1) || strcmp(g->attr[0].buf, long_value)) {
+		err = -7;
+		goto test_out;
+	}
+
+	if (attr_group_add(g, path, 4) != 1 || attr_group_add(g, path, 4) != -ENOSPC) {
+		err = -8;
+		goto test_out;
+	}
+
+	/* a seq_file larger than a page, read a page or less at a time */
+	attr_reader_set_batch(false);
+	attr_group_destroy(g);
+	g = attr_group_create(1);
+	attr_group_add(g, "/proc/self/smaps", 64);
+	len = attr_read(&g->attr[0]);
+	if ((len <= sysconf(_SC_PAGESIZE)) || (strlen(g->attr[0].buf) != len) ||
+	    (g->attr[0].buf[len - 1] != '\n') || !strstr(g->attr[0].buf + len / 2, "VmFlags:"))
+		err = -9;
+
+test_out:
+	attr_reader_set_batch(false);
+	if (fd >= 0)
+		close(fd);
+	unlink(path);
+	attr_group_destroy(g);
+	return err;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+
+#ifndef _ATTR_READER_H
+#define _ATTR_READER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define ATTR_PATH_SIZE			128
+
+/*
+ * A /proc or /sys attribute, kept open and re-read from offset 0.
+ */
+typedef struct {
+	char path[ATTR_PATH_SIZE];
+	int fd;
+	size_t size;
+	/* length of 'buf' (excluding the terminating '\0') or -errno, as of the last read */
+	ssize_t len;
+	char *buf;
+	/* sysfs: a short read is the end of the attribute (not so for a /proc seq_file) */
+	bool sysfs;
+} Attr;
+
+/*
+ * Attributes read together, by a single thread at a time.
+ * A group is read in a single batch if enabled, see attr_reader_set_batch().
+ */
+typedef struct {
+	int count;
+	int max;
+	struct AttrRing *ring;
+	bool ring_failed;
+	/* 'attr' must be the last */
+	Attr attr[0];
+} AttrGroup;
+
+void attr_reader_set_batch(bool enable);
+
+AttrGroup *attr_group_create(int max);
+void attr_group_destroy(AttrGroup *g);
+int attr_group_add(AttrGroup *g, const char *path, size_t size);
+int attr_group_read(AttrGroup *g);
+
+int attr_read(Attr *a);
+int attr_parse_long(Attr *a, long *value);
+
+int attr_reader_test(void);
+
+#endif	/* _ATTR_READER_H */
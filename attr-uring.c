@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ *
+ * Read an attribute group through an io_uring, one per group: an
+ * IORING_OP_READ per attribute is queued, then submitted and reaped with
+ * as few io_uring_enter() system calls as the kernel allows (a single one
+ * for a group fitting the ring, if it takes the whole submission).
+ * Raw system calls are used, as liburing is not a dependency of this daemon.
+ * Anything the ring cannot handle (unsupported opcode, an attribute to be
+ * reopened or outgrowing its buffer, a /proc seq_file needing more than one
+ * read) is left to the pread() path.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "common.h"
+#include "attr-reader.h"
+#include "attr-uring.h"
+
+
+struct AttrRing {
+	int fd;
+	unsigned int entries;
+
+	/* submission queue */
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/*
+ * Return:
+ * NULL if io_uring is not available (old kernel, seccomp, disabled by sysctl)
+ */
+AttrRing *attr_ring_create(unsigned int entries)
+{
+	struct io_uring_params p;
+	AttrRing *r;
+
+	r = (AttrRing *)calloc(1, sizeof(AttrRing));
+	if (r == NULL)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = io_uring_setup(entries, &p);
+	if (r->fd < 0) {
+		slogi("io_uring: not available: %m");
+		goto ring_create_out0;
+	}
+
+	r->entries = p.sq_entries;
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = 0;
+	}
+
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto ring_create_out1;
+
+	if (r->cq_ring_size == 0) {
+		r->cq_ring = r->sq_ring;
+	}
+	else {
+		r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED)
+			goto ring_create_out2;
+	}
+
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto ring_create_out3;
+
+	r->sq_head = (unsigned int *)((char *)r->sq_ring + p.sq_off.head);
+	r->sq_tail = (unsigned int *)((char *)r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+
+	return r;
+
+ring_create_out3:
+	if (r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+ring_create_out2:
+	munmap(r->sq_ring, r->sq_ring_size);
+ring_create_out1:
+	sloge("io_uring: could not map the rings: %m");
+	close(r->fd);
+ring_create_out0:
+	free(r);
+	return NULL;
+}
+
+void attr_ring_destroy(AttrRing *r)
+{
+	if (r == NULL)
+		return;
+
+	munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	munmap(r->sq_ring, r->sq_ring_size);
+	close(r->fd);
+	free(r);
+}
+
+static void attr_ring_queue(AttrRing *r, Attr *a, int index)
+{
+	unsigned int tail = *r->sq_tail;
+	unsigned int slot = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[slot];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = a->fd;
+	sqe->addr = (unsigned long)a->buf;
+	sqe->len = a->size - 1;
+	sqe->off = 0;
+	sqe->user_data = index;
+
+	r->sq_array[slot] = slot;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Return:
+ * the number of completions reaped
+ */
+static int attr_ring_reap(AttrRing *r, AttrGroup *g)
+{
+	unsigned int head = *r->cq_head;
+	struct io_uring_cqe *cqe;
+	Attr *a;
+	int n = 0;
+
+	while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		a = &g->attr[cqe->user_data];
+
+		/* only sysfs attributes are queued: a short read is the whole of it */
+		if ((cqe->res >= 0) && (cqe->res < a->size - 1)) {
+			a->buf[cqe->res] = '\0';
+			a->len = cqe->res;
+		}
+		else {
+			/* error, or the buffer might be too short: pread() knows better */
+			attr_read(a);
+		}
+
+		++head;
+		++n;
+	}
+
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/*
+ * Submit the 'queued' SQEs and reap their completions.
+ * The kernel may take only part of the submission (e.g. -EAGAIN, -EBUSY with
+ * the CQ ring full): the rest stays in the SQ ring, and is submitted again
+ * once there are completions to make room.
+ * Return:
+ * 0 on success, -errno if the ring failed
+ */
+static int attr_ring_complete(AttrRing *r, AttrGroup *g, unsigned int queued)
+{
+	unsigned int submitted = 0;
+	unsigned int reaped = 0;
+	unsigned int to_submit;
+	int ret;
+
+	while (reaped < queued) {
+		to_submit = queued - submitted;
+
+		/* a partial submission does not wait for completions */
+		do {
+			ret = io_uring_enter(r->fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+		} while ((ret < 0) && (errno == EINTR));
+
+		if (ret < 0) {
+			if (((errno != EAGAIN) && (errno != EBUSY)) || (submitted == reaped))
+				return -errno;
+
+			/* out of resources: wait for what is in flight */
+			do {
+				ret = io_uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS);
+			} while ((ret < 0) && (errno == EINTR));
+
+			if (ret < 0)
+				return -errno;
+		}
+		else {
+			submitted += ret;
+			/* nothing taken, nothing in flight: no progress to wait for */
+			if ((ret == 0) && (to_submit > 0) && (submitted == reaped))
+				return -EAGAIN;
+		}
+
+		reaped += attr_ring_reap(r, g);
+	}
+
+	return 0;
+}
+
+/*
+ * Read each attribute in the group, up to 'entries' attributes per batch.
+ * Return:
+ * the number of attributes read successfully, or -errno if the ring failed
+ */
+int attr_ring_read_group(AttrRing *r, AttrGroup *g)
+{
+	unsigned int queued;
+	int ok = 0;
+	int err;
+	int i;
+
+	for (i = 0; i < g->count;) {
+		queued = 0;
+		for (; (i < g->count) && (queued < r->entries); ++i) {
+			/* not open: let pread() path (re)open it; a seq_file may need several reads */
+			if ((g->attr[i].fd < 0) || !g->attr[i].sysfs) {
+				attr_read(&g->attr[i]);
+				continue;
+			}
+
+			attr_ring_queue(r, &g->attr[i], i);
+			++queued;
+		}
+
+		if (queued == 0)
+			break;
+
+		err = attr_ring_complete(r, g, queued);
+		if (err)
+			return err;
+	}
+
+	for (i = 0; i < g->count; ++i) {
+		if (g->attr[i].len >= 0)
+			++ok;
+	}
+
+	return ok;
+}
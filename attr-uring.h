@@ -0,0 +1,17 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+
+#ifndef _ATTR_URING_H
+#define _ATTR_URING_H
+
+#include "attr-reader.h"
+
+typedef struct AttrRing AttrRing;
+
+AttrRing *attr_ring_create(unsigned int entries);
+void attr_ring_destroy(AttrRing *r);
+int attr_ring_read_group(AttrRing *r, AttrGroup *g);
+
+#endif	/* _ATTR_URING_H */
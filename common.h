@@ -7,11 +7,12 @@
 #ifndef _COMMON_H
 #define _COMMON_H
 
+#include <stdbool.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "thread-pool.h"
 
-extern ThreadPool *frontend_thread;
 extern ThreadPool *backend_thread;
 
 
@@ -22,29 +23,107 @@ extern ThreadPool *backend_thread;
 #define slogd(...)			syslog(LOG_DEBUG,   __VA_ARGS__)
 
 
-typedef struct {
-	long bitmap;
-} InProcessingBitmap;
+static inline unsigned long long clock_monotonic_usec(void)
+{
+	struct timespec ts;
 
-void in_processing_add_request(long request, InProcessingBitmap *processing);
-void in_processing_remove_request(long request, InProcessingBitmap *processing);
-long in_processing_get_bitmap(InProcessingBitmap *processing);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
 
 
 #define ATFP_DAEMON_LOCKFILE		"/tmp/airtop-fpsvc.lock"
 #define ATFP_SYSLOG_IDENT		"at-fpsvc"
 #define ATFP_DAEMON_CONFIGFILE		"/etc/airtop-fpsvc.conf"
 
-/* maximum number of CPU cores */
+/* maximum number of front panels (FP controllers) */
+#define ATFP_MAX_PANELS			4
+
+/* number of FP CPU core slots; any number of cores is mapped onto these */
 #define ATFP_MAX_CPU_CORES		8
 
+/* maximum number of HDDs */
+#define ATFP_MAX_HDD			8
+
 #define ATFP_FRONTEND_QUEUE_LEN		16
 #define ATFP_BACKEND_THREAD_NUM		8
 #define ATFP_BACKEND_QUEUE_LEN		16
+/* main_thread runs on a single thread; a pending run absorbs further wake-ups */
+#define ATFP_SCHEDULER_QUEUE_LEN	2
 
 #define ATFP_MAIN_STARTUP_DELAY		2
 #define ATFP_MAIN_POLL_CYCLE		2
 
+/* FP requests (metric sources), indexed by ATFP_OFFS_PENDR0_* */
+#define ATFP_NUM_REQUESTS		4
+#define ATFP_REQUEST_NAMES		{"HDDTR", "CPUFR", "CPUTR", "GPUTR"}
+
+/*
+ * A request in processing longer than this [mSec] is reclaimed.
+ * Every backend task carries a watchdog deadline of ATFP_WATCHDOG_DEFAULT_DELAY
+ * seconds (of time() granularity, i.e. at least one second less), and a task
+ * missing it shuts the daemon down: the timeout must expire well before that.
+ */
+#define ATFP_STUCK_TIMEOUT		((ATFP_WATCHDOG_DEFAULT_DELAY - 2) * 1000)
+
+/*
+ * Requests being processed by the backend.
+ * Each dispatch of a request is tagged with a generation; only the task
+ * holding the current generation may complete the request, so that a task
+ * reclaimed after a timeout cannot clear (or publish over) a newer one.
+ */
+typedef struct {
+	long bitmap;
+	unsigned int generation[ATFP_NUM_REQUESTS];
+	unsigned long long since[ATFP_NUM_REQUESTS];	/* mSec, monotonic */
+} InProcessingBitmap;
+
+unsigned int in_processing_add_request(long request, InProcessingBitmap *processing);
+bool in_processing_remove_request(long request, unsigned int generation, InProcessingBitmap *processing);
+bool in_processing_is_current(long request, unsigned int generation, InProcessingBitmap *processing);
+long in_processing_get_bitmap(InProcessingBitmap *processing);
+int in_processing_reclaim(long request, unsigned long long timeout, InProcessingBitmap *processing);
+int in_processing_test(void);
+
+/*
+ * Default per-request poll interval and jitter [mSec].
+ * S.M.A.R.T. polling is expensive and might keep the disks awake,
+ * while HDD temperature changes slowly: poll it much less often.
+ * Other requests default to the poll cycle.
+ */
+#define ATFP_HDD_POLL_INTERVAL		60000
+#define ATFP_HDD_POLL_JITTER		5000
+
+/*
+ * Default SMART cache TTL [mSec]: just below the default HDD poll interval,
+ * so that a disk is read once a poll by default, and no more than about
+ * once a minute when HDDTR is polled (or requested) more often.
+ */
+#define ATFP_SMART_CACHE_TTL		55000
+
+/* HDD polls between forced rescans of the disks, see hdd-info.c */
+#define ATFP_HDD_RESCAN_POLLS		10
+
+/* a disk that could not be opened is not retried for [mSec], see hdd-info.c */
+#define ATFP_HDD_OPEN_BACKOFF		600000
+
+/*
+ * Default publication policy {abs, rel [%], hyst, hold [mSec]}, see PublishPolicy.
+ * Core and GPU temperatures flap by +/-1 degC: require a reversal to be
+ * 2 degC deep, and publish whatever is pending every 10 seconds.
+ * CPU frequency changes below 5% are not worth an update.
+ */
+#define ATFP_HDDTR_PUBLISH_POLICY	{1, 0, 0, 0}
+#define ATFP_CPUFR_PUBLISH_POLICY	{1, 5, 0, 10000}
+#define ATFP_CPUTR_PUBLISH_POLICY	{1, 0, 1, 10000}
+#define ATFP_GPUTR_PUBLISH_POLICY	{1, 0, 1, 10000}
+
+/*
+ * Default sensor cache TTL [mSec]: CPU and GPU temperature polls fire together,
+ * and the i915 GPU temperature is derived from the CPU sensors read just before.
+ */
+#define ATFP_SENSOR_CACHE_TTL		500
+
 #define ATFP_WATCHDOG_DEFAULT_DELAY	5
 
 #define ATFP_DAEMON_POSTCODE_MSB	0xDA
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ *
+ * Map an arbitrary number of per-core values onto the FP slots.
+ * The reductions are plain loops over int arrays, which the compiler
+ * vectorizes, so that mapping stays cheap on hosts with many cores.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "core-map.h"
+
+
+#define MAX_OF_LANES		8
+
+/*
+ * Lane-wise maxima over blocks of MAX_OF_LANES values:
+ * a fixed-width inner loop vectorizes even at -O2.
+ */
+static int max_of(const int *restrict v, int count)
+{
+	int acc[MAX_OF_LANES];
+	int m = INT_MIN;
+	int i;
+	int k;
+
+	for (k = 0; k < MAX_OF_LANES; ++k)
+		acc[k] = INT_MIN;
+
+	for (i = 0; i + MAX_OF_LANES <= count; i += MAX_OF_LANES) {
+		for (k = 0; k < MAX_OF_LANES; ++k)
+			acc[k] = (v[i + k] > acc[k]) ? v[i + k] : acc[k];
+	}
+
+	for (; i < count; ++i)
+		m = (v[i] > m) ? v[i] : m;
+
+	for (k = 0; k < MAX_OF_LANES; ++k)
+		m = (acc[k] > m) ? acc[k] : m;
+
+	return m;
+}
+
+/* 'count' cores into 'num_slots' groups of (nearly) the same size */
+static int map_group(const int *values, int count, int *slots, int num_slots)
+{
+	int start;
+	int end;
+	int i;
+
+	for (i = 0; i < num_slots; ++i) {
+		start = (int)((long)count * i / num_slots);
+		end = (int)((long)count * (i + 1) / num_slots);
+		slots[i] = max_of(&values[start], end - start);
+	}
+
+	return num_slots;
+}
+
+/* cores are ordered by package: a slot per run of the same package */
+static int map_socket(const int *values, const int *package, int count, int *slots, int num_slots)
+{
+	int n = 0;
+	int start;
+	int i;
+
+	if (package == NULL)
+		return map_group(values, count, slots, 1);
+
+	for (start = 0, i = 1; i <= count; ++i) {
+		if ((i < count) && (package[i] == package[start]))
+			continue;
+
+		if (n < num_slots)
+			slots[n++] = max_of(&values[start], i - start);
+		else
+			/* more packages than slots: fold the rest into the last one */
+			slots[n - 1] = (max_of(&values[start], i - start) > slots[n - 1]) ?
+				       max_of(&values[start], i - start) : slots[n - 1];
+		start = i;
+	}
+
+	return n;
+}
+
+/* keep the 'num_slots' highest values, sorted in descending order */
+static int map_hottest(const int *values, int count, int *slots, int num_slots)
+{
+	int n = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < count; ++i) {
+		if ((n == num_slots) && (values[i] <= slots[n - 1]))
+			continue;
+
+		j = (n < num_slots) ? n++ : (n - 1);
+		for (; (j > 0) && (slots[j - 1] < values[i]); --j)
+			slots[j] = slots[j - 1];
+		slots[j] = values[i];
+	}
+
+	return n;
+}
+
+/*
+ * Map 'count' per-core values onto up to 'num_slots' slots.
+ * 'package' (optional) is the package of each core, with cores ordered by package.
+ * Return:
+ * the number of slots filled
+ */
+int core_map(int mode, const int *values, const int *package, int count, int *slots, int num_slots)
+{
+	if (count <= 0)
+		return 0;
+
+	if ((count <= num_slots) && (mode != CORE_MAP_SOCKET)) {
+		memcpy(slots, values, count * sizeof(int));
+		return count;
+	}
+
+	switch (mode) {
+	case CORE_MAP_SOCKET:
+		return map_socket(values, package, count, slots, num_slots);
+	case CORE_MAP_HOTTEST:
+		return map_hottest(values, count, slots, num_slots);
+	case CORE_MAP_GROUP:
+	default:
+		return map_group(values, count, slots, num_slots);
+	}
+}
+
+
+/* unit test */
+int core_map_test(void)
+{
+	const int values[12] = {40, 41, 60, 43, 44, 45, 46, 70, 48, 49, 50, 39};
+	const int package[12] = {0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1};
+	const int group[4] = {60, 45, 70, 50};
+	const int socket[2] = {60, 70};
+	const int hottest[4] = {70, 60, 50, 49};
+	int slots[8];
+
+	if ((core_map(CORE_MAP_GROUP, values, package, 12, slots, 4) != 4) ||
+	    memcmp(slots, group, sizeof(group)))
+		return -1;
+
+	if ((core_map(CORE_MAP_SOCKET, values, package, 12, slots, 8) != 2) ||
+	    memcmp(slots, socket, sizeof(socket)))
+		return -2;
+
+	/* a single slot left for two packages */
+	if ((core_map(CORE_MAP_SOCKET, values, package, 12, slots, 1) != 1) || (slots[0] != 70))
+		return -3;
+
+	if ((core_map(CORE_MAP_HOTTEST, values, package, 12, slots, 4) != 4) ||
+	    memcmp(slots, hottest, sizeof(hottest)))
+		return -4;
+
+	/* fewer cores than slots: as is */
+	if ((core_map(CORE_MAP_HOTTEST, values, package, 3, slots, 8) != 3) || (slots[2] != 60))
+		return -5;
+
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+
+#ifndef _CORE_MAP_H
+#define _CORE_MAP_H
+
+/*
+ * How per-core values are mapped onto the (fewer) FP slots:
+ * GROUP   - consecutive cores are grouped evenly, a slot shows the group maximum
+ * SOCKET  - a slot per package (socket), showing the package maximum
+ * HOTTEST - the highest values, in descending order
+ * With no more cores than slots, each core gets its own slot.
+ */
+enum {
+	CORE_MAP_GROUP,
+	CORE_MAP_SOCKET,
+	CORE_MAP_HOTTEST,
+};
+
+int core_map(int mode, const int *values, const int *package, int count, int *slots, int num_slots);
+
+int core_map_test(void);
+
+#endif	/* _CORE_MAP_H */
@@ -8,106 +8,543 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <asm-generic/errno-base.h>
 
 #include "common.h"
+#include "attr-reader.h"
+#include "cpu-topology.h"
+#include "cpu-freq.h"
 
 
 #define PATH_PROC_CPUINFO		"/proc/cpuinfo"
+#define PATH_SYS_CPU			"/sys/devices/system/cpu"
+#define PATH_DEV_CPU_MSR		"/dev/cpu/%d/msr"
 
-#define starts_with(substr, str)	((str != NULL) && !strncmp((substr), (str), strlen(substr)))
+#define MSR_IA32_TSC			0x10
+#define MSR_IA32_MPERF			0xE7
+#define MSR_IA32_APERF			0xE8
+/* initial buffer size, grown to fit on the first read */
+#define CPUINFO_BUF_SIZE		16384
 
-enum {
-	CPUINFO_INIT,
-	CPUINFO_PROCESSOR_BLOCK,
-};
+/*
+ * /proc/cpuinfo parser.
+ *
+ * A single pass over the buffer, split into lines by memchr(); only the
+ * "processor", "physical id", "core id" and "cpu MHz" lines are looked at,
+ * and their values are parsed by hand. Nothing is allocated, and lines of
+ * any length (e.g. "flags") are handled.
+ */
 
-enum {
-	PROCBLOCK_CORE_ID	= 0x01,
-	PROCBLOCK_CPU_MHZ	= 0x02,
-	PROCBLOCK_ALL		= 0x03
-};
+typedef struct {
+	int processor;
+	int package;		/* -1: not reported */
+	int core;		/* -1: not reported */
+	int mhz;		/* -1: not reported */
+} CpuinfoBlock;
+
+#define line_is(key, line, len)		(((len) > sizeof(key) - 1) && !memcmp((line), (key), sizeof(key) - 1))
+
+/* the value following ':' */
+static const char *cpuinfo_value(const char *line, const char *end)
+{
+	const char *p = memchr(line, ':', end - line);
+
+	if (p == NULL)
+		return end;
+
+	for (++p; (p < end) && ((*p == ' ') || (*p == '\t')); ++p)
+		;
+	return p;
+}
+
+static int cpuinfo_uint(const char *p, const char *end)
+{
+	int value = 0;
+
+	if ((p >= end) || (*p < '0') || (*p > '9'))
+		return -1;
+
+	for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p)
+		value = value * 10 + (*p - '0');
+	return value;
+}
+
+/* "3593.246" -> 3593, rounded */
+static int cpuinfo_mhz(const char *p, const char *end)
+{
+	int value = cpuinfo_uint(p, end);
+
+	if (value < 0)
+		return -1;
 
+	for (; (p < end) && (*p >= '0') && (*p <= '9'); ++p)
+		;
+	if ((p + 1 < end) && (*p == '.') && (p[1] >= '5') && (p[1] <= '9'))
+		++value;
+	return value;
+}
+
+/*
+ * Account a processor block: the first thread of a physical core sets its frequency.
+ * Return:
+ * true if a new core has been added
+ */
+static bool cpuinfo_commit(const CpuinfoBlock *b, int *keys, int count, int max, int *freq_table, int *package_table)
+{
+	int key;
+	int i;
+
+	if ((b->processor < 0) || (b->mhz < 0) || (count >= max))
+		return false;
+
+	/* no core id (some hypervisors): each processor is a core */
+	key = ((b->package < 0) ? 0 : b->package) << 16;
+	key |= (b->core < 0) ? (b->processor | 0x8000) : b->core;
+	for (i = 0; i < count; ++i) {
+		if (keys[i] == key)
+			return false;
+	}
+
+	keys[count] = key;
+	freq_table[count] = b->mhz;
+	package_table[count] = (b->package < 0) ? 0 : b->package;
+	return true;
+}
+
+/*
+ * Order the cores by package, keeping the order of appearance within
+ * a package: processors of an interleaved multi-socket host alternate.
+ */
+static void cpuinfo_sort(int count, int *freq_table, int *package_table)
+{
+	int freq;
+	int package;
+	int i, j;
+
+	for (i = 1; i < count; ++i) {
+		freq = freq_table[i];
+		package = package_table[i];
+		for (j = i; (j > 0) && (package_table[j - 1] > package); --j) {
+			freq_table[j] = freq_table[j - 1];
+			package_table[j] = package_table[j - 1];
+		}
+		freq_table[j] = freq;
+		package_table[j] = package;
+	}
+}
 
 /**
- * Fill list of CPU core frequencies (in MHz). 
- * On a multithreaded core, the 1-st discovered thread sets the core frequency. 
- * Arguments:   								      .
- * cpuinfo - FILE struct pointing to an open /proc/cpuinfo file 									      .
- * num_cores - initially, the maximum available freq_table size,        															      .
- *             upon return, the number of freq_table entries that have been filled      																					.
- * freq_table - the table (list) of CPU core frequencies 																														.
+ * Fill list of CPU core frequencies (in MHz), ordered by package, then in the order of appearance.
+ * On a multithreaded core, the 1-st discovered thread sets the core frequency.
+ * Arguments:
+ * cpuinfo - /proc/cpuinfo contents, 'len' bytes
+ * num_cores - initially, the maximum available freq_table size,
+ *             upon return, the number of freq_table entries that have been filled
+ * freq_table - the table (list) of CPU core frequencies
+ * package_table - the package of each core ("physical id", 0 if not reported)
  */
-static void parse_cpuinfo(FILE *cpuinfo, int *num_cores, int *freq_table)
-{
-	char buff[128];
-	char *line;
-	int state;
-	int core_id;
-	float cpu_freq;
-	int real_num_cores;
-	int missing_data_bits = 0;
-	bool data_valid;
-
-	memset(freq_table, 0, *num_cores);
-	real_num_cores = 0;
-	state = CPUINFO_INIT;
-	while ( !feof(cpuinfo) ) {
-		line = fgets(buff, sizeof(buff), cpuinfo);
-		switch (state) {
-		case CPUINFO_INIT:
-			if (starts_with("processor", line)) {
-				missing_data_bits = PROCBLOCK_ALL;
-				state = CPUINFO_PROCESSOR_BLOCK;
-			}
-			break;
+static void parse_cpuinfo(const char *cpuinfo, size_t len, int *num_cores, int *freq_table, int *package_table)
+{
+	const char *end = cpuinfo + len;
+	const char *line;
+	const char *eol;
+	size_t n;
+	CpuinfoBlock b = { -1, -1, -1, -1 };
+	int keys[*num_cores + 1];
+	int count = 0;
 
-		case CPUINFO_PROCESSOR_BLOCK:
-			if (starts_with("core id", line)) {
-				sscanf(line, "core id : %d", &core_id);
-				missing_data_bits &= ~PROCBLOCK_CORE_ID;
-				break;
-			}
+	for (line = cpuinfo; line < end; line = eol + 1) {
+		eol = memchr(line, '\n', end - line);
+		if (eol == NULL)
+			eol = end;
+		n = eol - line;
 
-			if (starts_with("cpu MHz", line)) {
-				sscanf(line, "cpu MHz : %f", &cpu_freq);
-				missing_data_bits &= ~PROCBLOCK_CPU_MHZ;
-				break;
+		switch (line[0]) {
+		case 'p':
+			if (line_is("processor", line, n)) {
+				/* processor block end is a new block beginning, or end of file */
+				count += cpuinfo_commit(&b, keys, count, *num_cores, freq_table, package_table);
+				b.package = b.core = b.mhz = -1;
+				b.processor = cpuinfo_uint(cpuinfo_value(line, eol), eol);
 			}
-
-			/*
-			 * Processor block end is identified by either a
-			 * new block beginning or end of file.
-			 */
-			if (starts_with("processor", line) || feof(cpuinfo)) {
-				data_valid = !missing_data_bits;
-				missing_data_bits = PROCBLOCK_ALL;
-
-				if (data_valid && (core_id < *num_cores) && (freq_table[core_id] == 0)) {
-					freq_table[core_id] = (int)roundf(cpu_freq);
-					++real_num_cores;
-				}
-				break;
+			else if (line_is("physical id", line, n)) {
+				b.package = cpuinfo_uint(cpuinfo_value(line, eol), eol);
 			}
+			break;
 
+		case 'c':
+			if (line_is("core id", line, n))
+				b.core = cpuinfo_uint(cpuinfo_value(line, eol), eol);
+			else if (line_is("cpu MHz", line, n))
+				b.mhz = cpuinfo_mhz(cpuinfo_value(line, eol), eol);
 			break;
 		}
 	}
 
-	*num_cores = real_num_cores;
+	count += cpuinfo_commit(&b, keys, count, *num_cores, freq_table, package_table);
+	cpuinfo_sort(count, freq_table, package_table);
+	*num_cores = count;
+}
+
+/*
+ * MSR backend: the average busy frequency of each physical core since
+ * the previous poll, as turbostat's Bzy_MHz:
+ *   TSC rate * (APERF delta / MPERF delta)
+ * APERF/MPERF count only while the core is in C0, so that idle time does
+ * not dilute the result. Requires the msr driver and root privileges.
+ */
+typedef struct {
+	int fd;
+	unsigned long long tsc;
+	unsigned long long aperf;
+	unsigned long long mperf;
+	int mhz;
+} MsrCore;
+
+static MsrCore *msr_cores = NULL;
+static int msr_num_cores = 0;
+static unsigned long long msr_time = 0;
+
+static void cpu_freq_msr_cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < msr_num_cores; ++i)
+		close(msr_cores[i].fd);
+
+	free(msr_cores);
+	msr_cores = NULL;
+	msr_num_cores = 0;
 }
 
-void cpu_freq_get_list(int *num_cores, int *freq_list)
+static int cpu_freq_msr_init(void)
 {
-	FILE *cpuinfo;
+	const CpuTopology *topo = cpu_topology();
+	char path[32];
+	int i;
 
-	cpuinfo = fopen(PATH_PROC_CPUINFO, "r");
-	if ( !cpuinfo ) {
-		sloge("CPU Freq: could not open %s", PATH_PROC_CPUINFO);
-		return;
+	if (topo->num_cores == 0)
+		return -1;
+
+	msr_cores = (MsrCore *)calloc(topo->num_cores, sizeof(MsrCore));
+	if (msr_cores == NULL)
+		return -1;
+
+	for (i = 0; i < topo->num_cores; ++i) {
+		snprintf(path, sizeof(path), PATH_DEV_CPU_MSR, topo->core[i].cpu);
+		msr_cores[i].fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (msr_cores[i].fd < 0) {
+			slogi("CPU Freq: %s: %m: APERF/MPERF not available", path);
+			cpu_freq_msr_cleanup();
+			return -1;
+		}
+
+		msr_num_cores++;
 	}
 
-	parse_cpuinfo(cpuinfo, num_cores, freq_list);
-	fclose(cpuinfo);
+	return 0;
 }
 
+static int read_msr(int fd, unsigned int msr, unsigned long long *value)
+{
+	return (pread(fd, value, sizeof(*value), msr) == sizeof(*value)) ? 0 : -1;
+}
+
+/*
+ * Return:
+ * 0 on success, -EAGAIN until every core has been measured once, -1 on error
+ */
+static int cpu_freq_read_msr(int *num_cores, int *freq_table, int *package_table)
+{
+	const CpuTopology *topo = cpu_topology();
+	unsigned long long now = clock_monotonic_usec();
+	unsigned long long interval = now - msr_time;
+	unsigned long long tsc, aperf, mperf;
+	bool first = (msr_time == 0);
+	bool pending = false;
+	MsrCore *c;
+	int n = 0;
+	int i;
+
+	for (i = 0; i < msr_num_cores; ++i) {
+		c = &msr_cores[i];
+		if (read_msr(c->fd, MSR_IA32_TSC, &tsc) ||
+		    read_msr(c->fd, MSR_IA32_MPERF, &mperf) ||
+		    read_msr(c->fd, MSR_IA32_APERF, &aperf)) {
+			sloge("CPU Freq: could not read MSR: %m");
+			return -1;
+		}
+
+		/* a core idle over the whole interval keeps its last frequency */
+		if (!first && (interval > 0) && (mperf != c->mperf))
+			c->mhz = (int)((double)(tsc - c->tsc) / interval *
+				       (aperf - c->aperf) / (mperf - c->mperf) + 0.5);
+
+		c->tsc = tsc;
+		c->aperf = aperf;
+		c->mperf = mperf;
+		/* no reading yet: 0 MHz is not a frequency */
+		pending |= (c->mhz <= 0);
+
+		if (n < *num_cores) {
+			package_table[n] = (topo->package != NULL) ? topo->package[i] : 0;
+			freq_table[n++] = c->mhz;
+		}
+	}
+
+	msr_time = now;
+	if (pending)
+		return -EAGAIN;
+
+	*num_cores = n;
+	return 0;
+}
+
+/*
+ * cpufreq sysfs backend: scaling_cur_freq of each physical core, in
+ * topology order, kept open. Unavailable without a cpufreq driver
+ * (e.g. in most virtual machines), in which case /proc/cpuinfo is parsed.
+ */
+static AttrGroup *cpufreq_group = NULL;
+static AttrGroup *cpuinfo_group = NULL;
+static pthread_once_t cpu_freq_once = PTHREAD_ONCE_INIT;
+static int cpu_freq_source = CPU_FREQ_SOURCE_AUTO;
+
+static void cpu_freq_cleanup(void)
+{
+	cpu_freq_msr_cleanup();
+	attr_group_destroy(cpufreq_group);
+	attr_group_destroy(cpuinfo_group);
+	cpufreq_group = NULL;
+	cpuinfo_group = NULL;
+}
+
+static void cpu_freq_init(void)
+{
+	const CpuTopology *topo = cpu_topology();
+	char path[ATTR_PATH_SIZE];
+	int i;
+
+	if ((cpu_freq_source == CPU_FREQ_SOURCE_MSR) && cpu_freq_msr_init())
+		slogw("CPU Freq: MSR source is not available: falling back");
+
+	if ((topo->num_cores > 0) && (cpu_freq_source != CPU_FREQ_SOURCE_CPUINFO))
+		cpufreq_group = attr_group_create(topo->num_cores);
+
+	for (i = 0; (cpufreq_group != NULL) && (i < topo->num_cores); ++i) {
+		snprintf(path, sizeof(path), PATH_SYS_CPU "/cpu%d/cpufreq/scaling_cur_freq", topo->core[i].cpu);
+		attr_group_add(cpufreq_group, path, 16);
+	}
+
+	if ((cpufreq_group != NULL) && (attr_group_read(cpufreq_group) == 0)) {
+		slogi("CPU Freq: cpufreq is not available: using %s", PATH_PROC_CPUINFO);
+		attr_group_destroy(cpufreq_group);
+		cpufreq_group = NULL;
+	}
+
+	cpuinfo_group = attr_group_create(1);
+	if (cpuinfo_group != NULL)
+		attr_group_add(cpuinfo_group, PATH_PROC_CPUINFO, CPUINFO_BUF_SIZE);
+
+	atexit(cpu_freq_cleanup);
+}
+
+static int cpu_freq_read_sysfs(int *num_cores, int *freq_table, int *package_table)
+{
+	const CpuTopology *topo = cpu_topology();
+	long khz;
+	int n = 0;
+	int i;
+
+	if (attr_group_read(cpufreq_group) == 0)
+		return -1;
+
+	for (i = 0; (i < cpufreq_group->count) && (n < *num_cores); ++i) {
+		/* a core gone offline keeps its slot */
+		if (attr_parse_long(&cpufreq_group->attr[i], &khz))
+			khz = 0;
+		package_table[n] = (topo->package != NULL) ? topo->package[i] : 0;
+		freq_table[n++] = (int)((khz + 500) / 1000);
+	}
+
+	*num_cores = n;
+	return 0;
+}
+
+static int cpu_freq_read_cpuinfo(int *num_cores, int *freq_table, int *package_table)
+{
+	if ((cpuinfo_group == NULL) || (attr_group_read(cpuinfo_group) < 1)) {
+		sloge("CPU Freq: could not read %s", PATH_PROC_CPUINFO);
+		*num_cores = 0;
+		return -1;
+	}
+
+	parse_cpuinfo(cpuinfo_group->attr[0].buf, cpuinfo_group->attr[0].len, num_cores, freq_table, package_table);
+	return 0;
+}
+
+
+/*
+ * Select the frequency source; to be called before the first cpu_freq_get_list().
+ */
+void cpu_freq_set_source(int source)
+{
+	cpu_freq_source = source;
+}
+
+/*
+ * Fill 'freq_list' with up to '*num_cores' physical core frequencies [MHz],
+ * and 'package_list' with the package of each; cores are ordered by package,
+ * whichever the source.
+ * Only the CPUFR backend task gets here, one at a time.
+ */
+void cpu_freq_get_list(int *num_cores, int *freq_list, int *package_list)
+{
+	int max_cores = *num_cores;
+
+	pthread_once(&cpu_freq_once, cpu_freq_init);
+
+	if (msr_num_cores > 0) {
+		switch (cpu_freq_read_msr(num_cores, freq_list, package_list)) {
+		case 0:
+			return;
+		case -EAGAIN:
+			break;
+		default:
+			slogw("CPU Freq: MSR source failed: falling back");
+			cpu_freq_msr_cleanup();
+			break;
+		}
+	}
+
+	*num_cores = max_cores;
+	if ((cpufreq_group != NULL) && (cpu_freq_read_sysfs(num_cores, freq_list, package_list) == 0))
+		return;
+
+	*num_cores = max_cores;
+	cpu_freq_read_cpuinfo(num_cores, freq_list, package_list);
+}
+
+
+/*
+ * Test fixtures: /proc/cpuinfo captures (abridged) of several CPU families.
+ */
+#define FIXTURE_FLAGS	"flags\t\t: fpu vme de pse tsc msr pae mce cx8 apic sep mtrr pge mca cmov pat pse36 " \
+			"clflush dts acpi mmx fxsr sse sse2 ss ht tm pbe syscall nx pdpe1gb rdtscp lm " \
+			"constant_tsc arch_perfmon pebs bts rep_good nopl xtopology nonstop_tsc cpuid aperfmperf " \
+			"pni pclmulqdq dtes64 monitor ds_cpl vmx est tm2 ssse3 sdbg fma cx16 xtpr pdcm pcid sse4_1 " \
+			"sse4_2 x2apic movbe popcnt tsc_deadline_timer aes xsave avx f16c rdrand lahf_lm abm " \
+			"3dnowprefetch cpuid_fault epb invpcid_single pti ssbd ibrs ibpb stibp tpr_shadow vnmi " \
+			"flexpriority ept vpid ept_ad fsgsbase tsc_adjust bmi1 avx2 smep bmi2 erms invpcid mpx " \
+			"rdseed adx smap clflushopt intel_pt xsaveopt xsavec xgetbv1 xsaves dtherm ida arat pln pts\n"
+
+#define FIXTURE_X86(proc, pkg, core, mhz) \
+	"processor\t: " #proc "\n" \
+	"vendor_id\t: GenuineIntel\n" \
+	"cpu family\t: 6\n" \
+	"model name\t: Intel(R) Core(TM) i7-7700 CPU @ 3.60GHz\n" \
+	"cpu MHz\t\t: " mhz "\n" \
+	"cache size\t: 8192 KB\n" \
+	"physical id\t: " #pkg "\n" \
+	"siblings\t: 8\n" \
+	"core id\t\t: " #core "\n" \
+	"cpu cores\t: 4\n" \
+	FIXTURE_FLAGS \
+	"bogomips\t: 7200.00\n" \
+	"\n"
+
+#define FIXTURE_AMD(proc, core, mhz) \
+	"processor\t: " #proc "\n" \
+	"vendor_id\t: AuthenticAMD\n" \
+	"cpu family\t: 23\n" \
+	"model name\t: AMD Ryzen 5 3600 6-Core Processor\n" \
+	"cpu MHz\t\t: " mhz "\n" \
+	"physical id\t: 0\n" \
+	"core id\t\t: " #core "\n" \
+	"cpu cores\t: 6\n" \
+	"\n"
+
+typedef struct {
+	const char *name;
+	const char *cpuinfo;
+	int num_cores;
+	int freq[8];
+	int package[8];
+} CpuinfoFixture;
+
+static const CpuinfoFixture cpuinfo_fixtures[] = {
+	{
+		"Intel desktop, HT: the 1-st thread sets the core",
+		FIXTURE_X86(0, 0, 0, "3600.000") FIXTURE_X86(1, 0, 1, "800.123") FIXTURE_X86(2, 0, 2, "4199.501")
+		FIXTURE_X86(3, 0, 3, "1200.499") FIXTURE_X86(4, 0, 0, "900.000") FIXTURE_X86(5, 0, 1, "900.000")
+		FIXTURE_X86(6, 0, 2, "900.000") FIXTURE_X86(7, 0, 3, "900.000"),
+		4, {3600, 800, 4200, 1200},
+	},
+	{
+		"Intel dual-socket: core ids repeat per package",
+		FIXTURE_X86(0, 0, 0, "2100.000") FIXTURE_X86(1, 0, 1, "2200.000")
+		FIXTURE_X86(2, 1, 0, "2300.000") FIXTURE_X86(3, 1, 1, "2400.000"),
+		4, {2100, 2200, 2300, 2400}, {0, 0, 1, 1},
+	},
+	{
+		"Intel dual-socket, interleaved: ordered by package",
+		FIXTURE_X86(0, 0, 0, "2100.000") FIXTURE_X86(1, 1, 0, "2300.000")
+		FIXTURE_X86(2, 0, 1, "2200.000") FIXTURE_X86(3, 1, 1, "2400.000"),
+		4, {2100, 2200, 2300, 2400}, {0, 0, 1, 1},
+	},
+	{
+		"AMD Zen 2: sparse core ids, no trailing newline",
+		FIXTURE_AMD(0, 0, "3600.000") FIXTURE_AMD(1, 1, "3601.000") FIXTURE_AMD(2, 2, "3602.000")
+		FIXTURE_AMD(3, 4, "3603.000") FIXTURE_AMD(4, 5, "3604.000") FIXTURE_AMD(5, 6, "3605.000")
+		FIXTURE_AMD(6, 0, "2200.000") FIXTURE_AMD(7, 6, "2200.000")
+		"processor\t: 8\ncpu MHz\t\t: 2200.000\ncore id\t\t: 4",
+		6, {3600, 3601, 3602, 3603, 3604, 3605},
+	},
+	{
+		"hypervisor: neither physical nor core id",
+		"processor\t: 0\nvendor_id\t: GenuineIntel\ncpu MHz\t\t: 2593.906\n\n"
+		"processor\t: 1\nvendor_id\t: GenuineIntel\ncpu MHz\t\t: 2593.906\n\n",
+		2, {2594, 2594},
+	},
+	{
+		"ARM64: no cpu MHz",
+		"processor\t: 0\nBogoMIPS\t: 48.00\nFeatures\t: fp asimd evtstrm crc32 cpuid\n"
+		"CPU implementer\t: 0x41\nCPU part\t: 0xd08\n\n"
+		"processor\t: 1\nBogoMIPS\t: 48.00\nFeatures\t: fp asimd evtstrm crc32 cpuid\n\n",
+		0, {0},
+	},
+};
+
+
+/* unit test */
+int cpu_freq_test(void)
+{
+	const CpuinfoFixture *f;
+	int freq[8];
+	int package[8];
+	int num_cores;
+	int i;
+
+	for (i = 0; i < sizeof(cpuinfo_fixtures) / sizeof(cpuinfo_fixtures[0]); ++i) {
+		f = &cpuinfo_fixtures[i];
+		num_cores = 8;
+		parse_cpuinfo(f->cpuinfo, strlen(f->cpuinfo), &num_cores, freq, package);
+		if ((num_cores != f->num_cores) || memcmp(freq, f->freq, num_cores * sizeof(int)) ||
+		    memcmp(package, f->package, num_cores * sizeof(int))) {
+			printf("cpu_freq_test: %s: failed \n", f->name);
+			return -(i + 1);
+		}
+	}
+
+	/* a short table: the first cores only */
+	f = &cpuinfo_fixtures[0];
+	num_cores = 2;
+	parse_cpuinfo(f->cpuinfo, strlen(f->cpuinfo), &num_cores, freq, package);
+	if ((num_cores != 2) || (freq[1] != 800))
+		return -100;
+
+	return 0;
+}
@@ -7,7 +7,25 @@
 #ifndef _CPU_FREQ_H
 #define _CPU_FREQ_H
 
-void cpu_freq_get_list(int *num_cores, int *freq_list);
+/*
+ * Core frequency source:
+ * AUTO    - cpufreq sysfs, falling back to /proc/cpuinfo
+ * MSR     - effective (busy) frequency over the last poll interval,
+ *           from APERF/MPERF deltas, falling back to AUTO
+ * SYSFS   - cpufreq scaling_cur_freq, falling back to /proc/cpuinfo
+ * CPUINFO - /proc/cpuinfo "cpu MHz"
+ */
+enum {
+	CPU_FREQ_SOURCE_AUTO,
+	CPU_FREQ_SOURCE_MSR,
+	CPU_FREQ_SOURCE_SYSFS,
+	CPU_FREQ_SOURCE_CPUINFO,
+};
+
+void cpu_freq_set_source(int source);
+void cpu_freq_get_list(int *num_cores, int *freq_list, int *package_list);
+
+int cpu_freq_test(void);
 
 #endif	/* _CPU_FREQ_H */
 
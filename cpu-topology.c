@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ *
+ * CPU topology, discovered once from sysfs.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "cpu-topology.h"
+
+
+#define SYS_CPU_PATH			"/sys/devices/system/cpu"
+
+
+static CpuTopology topology = {0};
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+
+static int read_int(int dirfd, const char *name, int *value)
+{
+	char buffer[32];
+	int fd;
+	int n;
+
+	fd = openat(dirfd, name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	n = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+
+	buffer[n] = '\0';
+	*value = strtol(buffer, NULL, 10);
+	return 0;
+}
+
+static int core_compare(const void *a, const void *b)
+{
+	const CpuCore *x = (const CpuCore *)a;
+	const CpuCore *y = (const CpuCore *)b;
+
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+static void cpu_topology_cleanup(void)
+{
+	free(topology.core);
+	free(topology.package);
+	memset(&topology, 0, sizeof(topology));
+}
+
+static void cpu_topology_discover(void)
+{
+	DIR *root;
+	struct dirent *d;
+	CpuCore *cpus = NULL;
+	CpuCore *p;
+	char buffer[64];
+	int size = 0;
+	int topofd;
+	int i;
+
+	root = opendir(SYS_CPU_PATH);
+	if (root == NULL) {
+		sloge("%s: could not open directory: %m", SYS_CPU_PATH);
+		return;
+	}
+
+	while ((d = readdir(root)) != NULL) {
+		if (strncmp("cpu", d->d_name, 3) || !isdigit(d->d_name[3]))
+			continue;
+
+		/* offline CPUs have no topology */
+		snprintf(buffer, sizeof(buffer), "%s/topology", d->d_name);
+		topofd = openat(dirfd(root), buffer, O_RDONLY | O_DIRECTORY);
+		if (topofd < 0)
+			continue;
+
+		if (topology.num_cpus == size) {
+			size = size ? (size * 2) : 16;
+			p = (CpuCore *)realloc(cpus, size * sizeof(CpuCore));
+			if (p == NULL) {
+				close(topofd);
+				break;
+			}
+			cpus = p;
+		}
+
+		p = &cpus[topology.num_cpus];
+		p->cpu = strtol(&d->d_name[3], NULL, 10);
+		if (read_int(topofd, "physical_package_id", &p->package))
+			p->package = 0;
+		if (read_int(topofd, "core_id", &p->core))
+			p->core = p->cpu;
+		close(topofd);
+
+		topology.num_cpus++;
+	}
+
+	closedir(root);
+
+	if (topology.num_cpus == 0) {
+		free(cpus);
+		return;
+	}
+
+	/* keep the first thread of each physical core */
+	qsort(cpus, topology.num_cpus, sizeof(CpuCore), core_compare);
+	for (i = 0; i < topology.num_cpus; ++i) {
+		if (topology.num_cores > 0) {
+			p = &cpus[topology.num_cores - 1];
+			if ((p->package == cpus[i].package) && (p->core == cpus[i].core))
+				continue;
+			if (p->package != cpus[i].package)
+				topology.num_packages++;
+		}
+		else {
+			topology.num_packages = 1;
+		}
+
+		cpus[topology.num_cores++] = cpus[i];
+	}
+
+	topology.core = cpus;
+	topology.package = (int *)malloc(topology.num_cores * sizeof(int));
+	for (i = 0; (topology.package != NULL) && (i < topology.num_cores); ++i)
+		topology.package[i] = cpus[i].package;
+
+	slogi("CPU topology: %d packages, %d cores, %d CPUs",
+	      topology.num_packages, topology.num_cores, topology.num_cpus);
+
+	atexit(cpu_topology_cleanup);
+}
+
+/*
+ * Return:
+ * the topology of online CPUs at the time of the first call (num_cores is 0 if unknown)
+ */
+const CpuTopology *cpu_topology(void)
+{
+	pthread_once(&topology_once, cpu_topology_discover);
+	return &topology;
+}
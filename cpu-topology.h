@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+
+#ifndef _CPU_TOPOLOGY_H
+#define _CPU_TOPOLOGY_H
+
+/*
+ * A physical core, represented by its first logical CPU.
+ */
+typedef struct {
+	int cpu;
+	int package;
+	int core;		/* core id, unique within its package only */
+} CpuCore;
+
+typedef struct {
+	int num_cpus;		/* logical CPUs online */
+	int num_cores;		/* physical cores */
+	int num_packages;
+	/* sorted by package, then core id */
+	CpuCore *core;
+	/* the package of each core above, see core_map() */
+	int *package;
+} CpuTopology;
+
+const CpuTopology *cpu_topology(void);
+
+#endif	/* _CPU_TOPOLOGY_H */
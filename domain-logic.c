@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <asm-generic/errno-base.h>
 
 #include "common.h"
 #include "registers.h"
@@ -15,190 +17,594 @@
 #include "panel.h"
 #include "sensors.h"
 #include "cpu-freq.h"
+#include "cpu-topology.h"
+#include "core-map.h"
 #include "vga-tools.h"
 #include "hdd-info.h"
+#include "snapshot.h"
+#include "window.h"
+#include "stats.h"
+#include "options.h"
+#include "domain-logic.h"
 
 /*
- * Getting and setting core temperature.
+ * Backend results are computed once and fanned out to all the panels.
+ *
+ * Each metric is published into a preallocated snapshot (see snapshot.c).
+ * Once a snapshot has been updated, every panel is asked to flush: the
+ * panel frontend encodes the newest snapshots in place into its image, and
+ * writes the difference to the FP. A flush request is queued only if none
+ * is pending for that panel already, thus when the backend runs faster than
+ * the bus, the frontend simply sees the newest data.
  */
 
+static MetricSnapshot snapshots[ATFP_METRIC_NUM];
+
 typedef struct {
-	int num_sensors;
-	int temp[ATFP_MAX_CPU_CORES];
-} CpuTemp;
+	int flush_pending;
+	unsigned int seen[ATFP_METRIC_NUM];
+} PanelSync;
+
+static PanelSync panel_sync[ATFP_MAX_PANELS];
 
-static void set_temperature(void *priv_context, void *shared_context)
+/* frontend */
+static void flush_panel(void *priv_context, void *shared_context)
 {
-	CpuTemp *context = (CpuTemp *)priv_context;
-	int core_id;
-	int temp;
-	int err;
+	Panel *panel = (Panel *)shared_context;
+	PanelSync *sync = &panel_sync[panel_index(panel)];
+	MetricSnapshot *snap;
+	unsigned int seq;
+	int metric;
+
+	__atomic_store_n(&sync->flush_pending, 0, __ATOMIC_SEQ_CST);
 
-	for (core_id = 0; core_id < context->num_sensors; ++core_id) {
-		temp = context->temp[core_id];
-		slogd("CPUTR: Core %d: %d [degC]", core_id, temp);
-		err = panel_set_temperature(core_id, temp);
-		if ( err )
-			break;
+	for (metric = 0; metric < ATFP_METRIC_NUM; ++metric) {
+		snap = &snapshots[metric];
+		do {
+			seq = snapshot_read_begin(snap);
+			if (seq == sync->seen[metric])
+				break;
+
+			panel_image_encode(panel_image(panel), metric, snap->count, snap->value, snap->valid_mask);
+		} while (snapshot_read_retry(snap, seq));
+
+		sync->seen[metric] = seq;
 	}
 
-	free(context);
-	in_processing_remove_request(ATFP_MASK_PENDR0_CPUTR, shared_context);
+	panel_flush(panel);
 }
 
-static void get_temperature(void *priv_context, void *shared_context)
+/*
+ * Publication policy.
+ *
+ * Each backend result passes a per-metric change-detection filter before
+ * it is published: slots whose value did not change meaningfully (see
+ * PublishPolicy) keep their last published value, and when no slot has
+ * changed, the snapshot is not updated and the panels are not woken up.
+ */
+
+typedef struct {
+	int value;
+	int direction;
+	unsigned long long time;	/* mSec */
+} PublishedSlot;
+
+typedef struct {
+	int source;			/* ATFP_OFFS_PENDR0_*, or -1: no filtering */
+	PublishPolicy policy;
+	int count;
+	unsigned int valid_mask;
+	PublishedSlot slot[ATFP_SNAPSHOT_SLOTS];
+} PublishFilter;
+
+static PublishFilter publish_filters[ATFP_METRIC_NUM] = {
+	[ATFP_METRIC_CPUT]	= {ATFP_OFFS_PENDR0_CPUTR, ATFP_CPUTR_PUBLISH_POLICY},
+	[ATFP_METRIC_GPUT]	= {ATFP_OFFS_PENDR0_GPUTR, ATFP_GPUTR_PUBLISH_POLICY},
+	[ATFP_METRIC_AMBT]	= {ATFP_OFFS_PENDR0_GPUTR, ATFP_GPUTR_PUBLISH_POLICY},
+	[ATFP_METRIC_HDDT]	= {ATFP_OFFS_PENDR0_HDDTR, ATFP_HDDTR_PUBLISH_POLICY},
+	[ATFP_METRIC_ADC]	= {-1},
+	[ATFP_METRIC_MEM]	= {-1},
+	[ATFP_METRIC_HDDSZ]	= {-1},
+	[ATFP_METRIC_CPUF]	= {ATFP_OFFS_PENDR0_CPUFR, ATFP_CPUFR_PUBLISH_POLICY},
+};
+
+void panel_set_publish_policy(int request, const PublishPolicy *policy)
 {
-	int temp;
-	int core_id;
-	int core_id_save;
-	int err;
-	CpuTemp *context = (CpuTemp *)malloc(sizeof(CpuTemp));
+	int metric;
+
+	for (metric = 0; metric < ATFP_METRIC_NUM; ++metric) {
+		if (publish_filters[metric].source == request)
+			publish_filters[metric].policy = *policy;
+	}
+}
 
-	context->num_sensors = 0;
-	for (core_id = 0; core_id >= 0;) {
-		core_id_save = core_id;
-		err = sensors_coretemp_read(&core_id, &temp);
-		if ( err )
-			break;
+static bool publish_slot(PublishFilter *f, PublishedSlot *ps, int value, unsigned long long now)
+{
+	const PublishPolicy *policy = &f->policy;
+	int delta = value - ps->value;
+	int direction = (delta > 0) - (delta < 0);
+	int threshold;
+
+	if (delta == 0)
+		return false;
+
+	threshold = policy->abs;
+	if ((policy->rel > 0) && ((abs(ps->value) * policy->rel / 100) > threshold))
+		threshold = abs(ps->value) * policy->rel / 100;
+	if ((ps->direction != 0) && (direction != ps->direction))
+		threshold += policy->hyst;
+
+	if ((abs(delta) < threshold) &&
+	    !((policy->hold > 0) && ((now - ps->time) >= policy->hold)))
+		return false;
+
+	ps->value = value;
+	ps->direction = direction;
+	ps->time = now;
+	return true;
+}
 
-		context->temp[core_id_save] = temp;
-		context->num_sensors++;
+/*
+ * Filter a metric in place: 'values' is updated to what should be displayed.
+ * Return:
+ * true if anything has changed
+ */
+static bool publish_filter(int metric, int count, int *values, unsigned int valid_mask)
+{
+	PublishFilter *f = &publish_filters[metric];
+	unsigned long long now = clock_monotonic_usec() / 1000;
+	unsigned int published = 0;
+	unsigned int suppressed = 0;
+	bool changed;
+	int i;
+
+	if (f->source < 0)
+		return true;
+
+	if (count > ATFP_SNAPSHOT_SLOTS)
+		count = ATFP_SNAPSHOT_SLOTS;
+
+	changed = (count != f->count) || (valid_mask != f->valid_mask);
+	for (i = 0; i < count; ++i) {
+		if ( !(valid_mask & (1U << i)) )
+			continue;
+
+		if ( !(f->valid_mask & (1U << i)) || (i >= f->count) ) {
+			/* newly valid: always published */
+			f->slot[i].value = values[i];
+			f->slot[i].direction = 0;
+			f->slot[i].time = now;
+			++published;
+		}
+		else if (publish_slot(f, &f->slot[i], values[i], now)) {
+			++published;
+		}
+		else if (values[i] != f->slot[i].value) {
+			values[i] = f->slot[i].value;
+			++suppressed;
+		}
 	}
 
-	thread_pool_add_request(frontend_thread, set_temperature, context);
+	f->count = count;
+	f->valid_mask = valid_mask;
+	stat_add_publish(f->source, published, suppressed);
+
+	return changed || (published > 0);
+}
+
+/* backend */
+static bool publish_metric(int metric, int count, int *values, unsigned int valid_mask)
+{
+	if ( !publish_filter(metric, count, values, valid_mask) )
+		return false;
+
+	snapshot_publish(&snapshots[metric], count, values, valid_mask);
+	return true;
 }
 
-void panel_update_temperature(void)
+static void request_panels_flush(void)
 {
-	thread_pool_add_request(backend_thread, get_temperature, NULL);
+	int i;
+
+	for (i = 0; i < panel_count(); ++i) {
+		if (__atomic_exchange_n(&panel_sync[i].flush_pending, 1, __ATOMIC_SEQ_CST))
+			continue;
+
+		if (thread_pool_try_add_request(panel_frontend(panel_get(i)), flush_panel, NULL))
+			__atomic_store_n(&panel_sync[i].flush_pending, 0, __ATOMIC_SEQ_CST);
+	}
+}
+
+
+/*
+ * Request completion.
+ *
+ * Backend tasks get the generation of their request as 'priv_context'.
+ * A stale task, whose request has been reclaimed (and possibly dispatched
+ * again) while it was stuck, drops its result instead of publishing over
+ * a newer one. Otherwise the result is published while the request is still
+ * in processing, so that the scheduler does not dispatch it again meanwhile,
+ * and only then is the request completed.
+ * The publication of each request is also serialized: a reclaim in the midst
+ * of it lets a new task in, while the metrics (publish filter, snapshot
+ * seqlock) take a single writer.
+ */
+
+#define REQUEST_GENERATION_CONTEXT(g)	((void *)(unsigned long)(g))
+
+static pthread_mutex_t publish_lock[ATFP_NUM_REQUESTS] = {
+	[0 ... (ATFP_NUM_REQUESTS - 1)] = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * Return:
+ * true if the result is to be published, followed by request_publish_end(),
+ * false for a stale task
+ */
+static bool request_publish_begin(long request, void *priv_context, void *shared_context)
+{
+	unsigned int generation = (unsigned long)priv_context;
+	int i = __builtin_ctzl(request);
+
+	pthread_mutex_lock(&publish_lock[i]);
+	if ( !in_processing_is_current(request, generation, shared_context) ) {
+		pthread_mutex_unlock(&publish_lock[i]);
+		stat_inc_stale(i);
+		slogw("request 0x%lx: stale completion dropped", request);
+		return false;
+	}
+
+	return true;
 }
 
+static void request_publish_end(long request, void *priv_context, void *shared_context)
+{
+	unsigned int generation = (unsigned long)priv_context;
+	int i = __builtin_ctzl(request);
+
+	/* reclaimed while publishing: counted as stale */
+	in_processing_remove_request(request, generation, shared_context);
+	pthread_mutex_unlock(&publish_lock[i]);
+}
 
 /*
- * Getting and setting core frequency.
+ * High-rate sampling.
+ *
+ * Cheap sources may be sampled more often than they are published:
+ * the sampling task pushes each reading into a per-slot sliding window,
+ * and the publication task takes the window aggregate (max, mean or p95),
+ * so that short spikes between polls are not missed, while the FP still
+ * gets one update per poll interval.
  */
 
 typedef struct {
-	int num_cores;
-	int freq[ATFP_MAX_CPU_CORES];
-} CpuFreq;
+	pthread_mutex_t lock;
+	int busy;		/* a sampling task is queued or running */
+	int window_len;		/* 0: sampling is off */
+	int aggregate;
+	int count;		/* slots sampled */
+	SampleWindow window[ATFP_SNAPSHOT_SLOTS];
+} SampleSet;
+
+static SampleSet samples[ATFP_NUM_REQUESTS] = {
+	[0 ... (ATFP_NUM_REQUESTS - 1)] = { .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+
+static void sample_push(SampleSet *ss, int count, const int *values)
+{
+	int i;
+
+	if (count > ATFP_SNAPSHOT_SLOTS)
+		count = ATFP_SNAPSHOT_SLOTS;
+
+	pthread_mutex_lock(&ss->lock);
+	if (count != ss->count) {
+		/* topology change: start over */
+		for (i = 0; i < count; ++i)
+			window_init(&ss->window[i], ss->window_len);
+		ss->count = count;
+	}
+
+	for (i = 0; i < count; ++i)
+		window_push(&ss->window[i], values[i]);
+	pthread_mutex_unlock(&ss->lock);
+}
+
+/*
+ * Return:
+ * the number of slots aggregated into 'values', 0 if nothing was sampled
+ */
+static int sample_aggregate(SampleSet *ss, int *values)
+{
+	int count;
+	int i;
+
+	if (ss->window_len == 0)
+		return 0;
+
+	pthread_mutex_lock(&ss->lock);
+	count = ss->count;
+	for (i = 0; i < count; ++i)
+		values[i] = window_aggregate(&ss->window[i], ss->aggregate);
+	pthread_mutex_unlock(&ss->lock);
+
+	return count;
+}
 
-static void set_frequency(void *priv_context, void *shared_context)
+/*
+ * Enable sampling of a request; 'window_len' samples are aggregated.
+ */
+int panel_set_sampling(int request, int window_len, int aggregate)
 {
-	CpuFreq *context = (CpuFreq *)priv_context;
+	if ((request != ATFP_OFFS_PENDR0_CPUTR) && (request != ATFP_OFFS_PENDR0_GPUTR))
+		return -EINVAL;
+
+	samples[request].window_len = (window_len < 1) ? 1 : window_len;
+	samples[request].aggregate = aggregate;
+	return 0;
+}
+
+/*
+ * Getting core temperature.
+ */
+
+/* how the cores are mapped onto the FP slots */
+static int core_map_mode = CORE_MAP_GROUP;
+
+void panel_set_core_map(int mode)
+{
+	core_map_mode = mode;
+}
+
+/*
+ * Read all the cores, and map them onto the FP slots.
+ * Return:
+ * the number of slots filled
+ */
+static int read_temperature(int *temp)
+{
+	int core_temp[sensors_coretemp_count() + 1];
+	int package[sensors_coretemp_count() + 1];
+	int num_sensors;
+
+	num_sensors = sensors_coretemp_read_all(core_temp, package, sensors_coretemp_count());
+	if (num_sensors < 0)
+		return 0;
+
+	return core_map(core_map_mode, core_temp, package, num_sensors, temp, ATFP_MAX_CPU_CORES);
+}
+
+static void sample_temperature(void *priv_context, void *shared_context)
+{
+	SampleSet *ss = &samples[ATFP_OFFS_PENDR0_CPUTR];
+	int temp[ATFP_MAX_CPU_CORES];
+	int num_sensors;
+
+	num_sensors = read_temperature(temp);
+	sample_push(ss, num_sensors, temp);
+	__atomic_store_n(&ss->busy, 0, __ATOMIC_RELEASE);
+}
+
+static void get_temperature(void *priv_context, void *shared_context)
+{
+	int temp[ATFP_MAX_CPU_CORES];
+	int num_sensors;
 	int core_id;
-	int freq;
-	int err;
+	bool changed;
+	unsigned long long start = clock_monotonic_usec();
 
-	for (core_id = 0; core_id < context->num_cores; ++core_id) {
-		freq = context->freq[core_id];
-		slogd("CPUFR: %d [MHz]", freq);
-		err = panel_set_frequency(core_id, freq);
-		if ( err )
-			break;
-	}
+	num_sensors = sample_aggregate(&samples[ATFP_OFFS_PENDR0_CPUTR], temp);
+	if (num_sensors == 0)
+		num_sensors = read_temperature(temp);
+
+	for (core_id = 0; core_id < num_sensors; ++core_id)
+		slogd("CPUTR: Core %d: %d [degC]", core_id, temp[core_id]);
+
+	stat_add_source_time(ATFP_OFFS_PENDR0_CPUTR, clock_monotonic_usec() - start);
+	if ( !request_publish_begin(ATFP_MASK_PENDR0_CPUTR, priv_context, shared_context) )
+		return;
 
-	free(context);
-	in_processing_remove_request(ATFP_MASK_PENDR0_CPUFR, shared_context);
+	changed = publish_metric(ATFP_METRIC_CPUT, num_sensors, temp, ~0U);
+	request_publish_end(ATFP_MASK_PENDR0_CPUTR, priv_context, shared_context);
+	if (changed)
+		request_panels_flush();
 }
 
+int panel_update_temperature(unsigned int generation)
+{
+	return thread_pool_try_add_request(backend_thread, get_temperature, REQUEST_GENERATION_CONTEXT(generation));
+}
+
+
+/*
+ * Getting core frequency.
+ */
+
 static void get_frequency(void *priv_context, void *shared_context)
 {
-	CpuFreq *context = (CpuFreq *)malloc(sizeof(CpuFreq));
+	const CpuTopology *topo = cpu_topology();
+	/* room for sparse core ids, should cpu_freq_get_list() fall back to /proc/cpuinfo */
+	int core_freq[topo->num_cpus + ATFP_MAX_CPU_CORES];
+	int core_package[topo->num_cpus + ATFP_MAX_CPU_CORES];
+	int freq[ATFP_MAX_CPU_CORES];
+	int num_cores = topo->num_cpus + ATFP_MAX_CPU_CORES;
+	int slot;
+	bool changed;
+	unsigned long long start = clock_monotonic_usec();
+
+	cpu_freq_get_list(&num_cores, core_freq, core_package);
+	num_cores = core_map(core_map_mode, core_freq, core_package, num_cores, freq, ATFP_MAX_CPU_CORES);
 
-	context->num_cores = ATFP_MAX_CPU_CORES;
+	for (slot = 0; slot < num_cores; ++slot)
+		slogd("CPUFR: %d [MHz]", freq[slot]);
 
-	cpu_freq_get_list(&context->num_cores, context->freq);
-	thread_pool_add_request(frontend_thread, set_frequency, context);
+	stat_add_source_time(ATFP_OFFS_PENDR0_CPUFR, clock_monotonic_usec() - start);
+	if ( !request_publish_begin(ATFP_MASK_PENDR0_CPUFR, priv_context, shared_context) )
+		return;
+
+	changed = publish_metric(ATFP_METRIC_CPUF, num_cores, freq, ~0U);
+	request_publish_end(ATFP_MASK_PENDR0_CPUFR, priv_context, shared_context);
+	if (changed)
+		request_panels_flush();
 }
 
-void panel_update_frequency(void)
+int panel_update_frequency(unsigned int generation)
 {
-	thread_pool_add_request(backend_thread, get_frequency, NULL);
+	return thread_pool_try_add_request(backend_thread, get_frequency, REQUEST_GENERATION_CONTEXT(generation));
 }
 
 
 /* 
- * Getting and setting GPU temperature.
+ * Getting GPU temperature.
+ *
+ * The FP does not request the ambient temperature on its own:
+ * it is read along with the GPU temperature, sharing SENSORT with it.
  */
 
-static void set_gpu_temperature(void *priv_context, void *shared_context)
+/* hwmon source of the ambient temperature, see sensors_hwmon_add() */
+static int ambient_sensor = -ENODEV;
+
+void panel_set_ambient_sensor(int handle)
 {
-	int *temp = (int *)priv_context;
+	ambient_sensor = handle;
+}
 
-	if (temp != NULL) {
-		slogd("GPUTR: %d [degC]", *temp);
-		panel_set_gpu_temp(*temp);
-		free(temp);
-	}
-	else {
-		slogw("GPU Temp: abort request");
-	}
+static void sample_gpu_temperature(void *priv_context, void *shared_context)
+{
+	SampleSet *ss = &samples[ATFP_OFFS_PENDR0_GPUTR];
+	int temp;
 
-	in_processing_remove_request(ATFP_MASK_PENDR0_GPUTR, shared_context);
+	if (GPU_get_temperature(&temp) == 0)
+		sample_push(ss, 1, &temp);
+	__atomic_store_n(&ss->busy, 0, __ATOMIC_RELEASE);
 }
 
 static void get_gpu_temperature(void *priv_context, void *shared_context)
 {
 	int temp;
-	int *context;
+	int ambient = 0;
 	int err;
+	int ambient_err = -ENODEV;
+	bool changed = false;
+	unsigned long long start = clock_monotonic_usec();
+
+	err = (sample_aggregate(&samples[ATFP_OFFS_PENDR0_GPUTR], &temp) == 1) ? 0 : GPU_get_temperature(&temp);
+	if (ambient_sensor >= 0)
+		ambient_err = sensors_hwmon_read(ambient_sensor, &ambient);
+	stat_add_source_time(ATFP_OFFS_PENDR0_GPUTR, clock_monotonic_usec() - start);
+	if ( !request_publish_begin(ATFP_MASK_PENDR0_GPUTR, priv_context, shared_context) )
+		return;
 
-	err = GPU_get_temperature(&temp);
 	if (err == 0) {
-		context = (int *)malloc(sizeof(int));
-		*context = temp;
+		slogd("GPUTR: %d [degC]", temp);
+		changed = publish_metric(ATFP_METRIC_GPUT, 1, &temp, 1);
 	}
 	else {
-		context = NULL;
+		slogw("GPU Temp: abort request");
+	}
+
+	if (ambient_sensor >= 0) {
+		slogd("AMBT: %d [degC], err %d", ambient, ambient_err);
+		/* an ambient reading failure invalidates the slot */
+		changed |= publish_metric(ATFP_METRIC_AMBT, 1, &ambient, (ambient_err == 0) ? 1 : 0);
 	}
-	thread_pool_add_request(frontend_thread, set_gpu_temperature, context);
+	request_publish_end(ATFP_MASK_PENDR0_GPUTR, priv_context, shared_context);
+
+	if (changed)
+		request_panels_flush();
 }
 
-void panel_update_gpu_temp(void)
+int panel_update_gpu_temp(unsigned int generation)
 {
-	thread_pool_add_request(backend_thread, get_gpu_temperature, NULL);
+	return thread_pool_try_add_request(backend_thread, get_gpu_temperature, REQUEST_GENERATION_CONTEXT(generation));
 }
 
 
 /*
- * Getting and setting HDD temperature.
+ * Getting HDD temperature.
  */
 
-static void set_hdd_temperature(void *priv_context, void *shared_context)
+static void get_hdd_temperature(void *priv_context, void *shared_context)
 {
-	DList *hdd_list = (DList *)priv_context;
+	DList *hdd_list;
 	SMARTinfo *si;
 	int index;
+	int temp[ATFP_MAX_HDD];
+	int size[ATFP_MAX_HDD];
+	unsigned int temp_valid = 0;
+	unsigned int size_valid = 0;
+	bool changed;
+	unsigned long long start = clock_monotonic_usec();
+
+	hdd_get_temperature(&hdd_list);
 
 	index = 0;
 	while ((si = dlist_pop_front(hdd_list)) != NULL) {
-		if (si->temp_valid) {
-			slogd("HDDTR: %s: %u [degC]", si->devname, si->temp);
-			panel_set_hdd_temp(index, si->temp);
+		if (index >= ATFP_MAX_HDD) {
+			slogw("HDD: index out of range: %d", index);
 		}
 		else {
-			slogd("HDDTR: %s: --", si->devname);
+			if (si->temp_valid) {
+				slogd("HDDTR: %s: %u [degC]%s", si->devname, si->temp, si->stale ? " (stale)" : "");
+				temp[index] = si->temp;
+				temp_valid |= (1U << index);
+			}
+			else {
+				slogd("HDDTR: %s: --", si->devname);
+			}
+
+			if (si->size_valid) {
+				size[index] = si->size_GB;
+				size_valid |= (1U << index);
+			}
+
+			++index;
 		}
 
 		delete_SMARTinfo(si);
-		++index;
 	}
 
-	in_processing_remove_request(ATFP_MASK_PENDR0_HDDTR, shared_context);
+	stat_add_source_time(ATFP_OFFS_PENDR0_HDDTR, clock_monotonic_usec() - start);
+	if ( !request_publish_begin(ATFP_MASK_PENDR0_HDDTR, priv_context, shared_context) )
+		return;
+
+	changed = publish_metric(ATFP_METRIC_HDDT, index, temp, temp_valid);
+	changed |= publish_metric(ATFP_METRIC_HDDSZ, index, size, size_valid);
+	request_publish_end(ATFP_MASK_PENDR0_HDDTR, priv_context, shared_context);
+	if (changed)
+		request_panels_flush();
 }
 
-static void get_hdd_temperature(void *priv_context, void *shared_context)
+int panel_update_hdd_temp(unsigned int generation)
 {
-	DList *hdd_list;
-
-	hdd_get_temperature(&hdd_list);
-	thread_pool_add_request(frontend_thread, set_hdd_temperature, hdd_list);
+	return thread_pool_try_add_request(backend_thread, get_hdd_temperature, REQUEST_GENERATION_CONTEXT(generation));
 }
 
-void panel_update_hdd_temp(void)
+
+/*
+ * Dispatch a sampling task, unless the previous one is still pending.
+ */
+void panel_sample(int request)
 {
-	thread_pool_add_request(backend_thread, get_hdd_temperature, NULL);
+	SampleSet *ss = &samples[request];
+	ThreadPoolWork func;
+
+	switch (request) {
+	case ATFP_OFFS_PENDR0_CPUTR:
+		func = sample_temperature;
+		break;
+	case ATFP_OFFS_PENDR0_GPUTR:
+		func = sample_gpu_temperature;
+		break;
+	default:
+		return;
+	}
+
+	if (__atomic_exchange_n(&ss->busy, 1, __ATOMIC_ACQUIRE))
+		return;
+
+	if (thread_pool_try_add_request(backend_thread, func, NULL))
+		__atomic_store_n(&ss->busy, 0, __ATOMIC_RELEASE);
 }
 
 
@@ -214,6 +620,7 @@ void panel_update_hdd_temp(void)
 typedef struct {
 	unsigned int delay_sec;
 	ThreadPoolWork func;
+	Panel *panel;
 } DelayInfo;
 
 /* backend */
@@ -222,15 +629,18 @@ static void backend_delay(void *priv_context, void *shared_context)
 	DelayInfo *di = (DelayInfo *)priv_context;
 
 	sleep(di->delay_sec);
-	thread_pool_add_request(frontend_thread, di->func, (void *)di);
+	/* congested frontend: try again later rather than block the backend */
+	if (thread_pool_try_add_request(panel_frontend(di->panel), di->func, (void *)di))
+		thread_pool_add_request(backend_thread, backend_delay, priv_context);
 }
 
 /* frontend */
 void really_store_daemon_postcode(void *priv_context, void *shared_context)
 {
+	Panel *panel = (Panel *)shared_context;
 	int err;
 
-	err = panel_store_daemon_postcode();
+	err = panel_store_daemon_postcode(panel);
 	if (err == 0) {
 		/* success */
 		free(priv_context);
@@ -241,18 +651,22 @@ void really_store_daemon_postcode(void *priv_context, void *shared_context)
 	thread_pool_add_request(backend_thread, backend_delay, priv_context);
 }
 
-DelayInfo *postcode_info;
-
 void FP_store_daemon_postcode(void)
 {
-	postcode_info = (DelayInfo *)calloc(1, sizeof(DelayInfo));
+	DelayInfo *postcode_info;
+	int i;
 
-	postcode_info->delay_sec = ATFP_MAIN_STARTUP_DELAY;
-	if (postcode_info->delay_sec >= ATFP_WATCHDOG_DEFAULT_DELAY)
-		postcode_info->delay_sec = ATFP_WATCHDOG_DEFAULT_DELAY >> 1;
+	for (i = 0; i < panel_count(); ++i) {
+		postcode_info = (DelayInfo *)calloc(1, sizeof(DelayInfo));
 
-	postcode_info->func = really_store_daemon_postcode;
+		postcode_info->delay_sec = ATFP_MAIN_STARTUP_DELAY;
+		if (postcode_info->delay_sec >= ATFP_WATCHDOG_DEFAULT_DELAY)
+			postcode_info->delay_sec = ATFP_WATCHDOG_DEFAULT_DELAY >> 1;
 
-	thread_pool_add_request(backend_thread, backend_delay, (void *)postcode_info);
+		postcode_info->func = really_store_daemon_postcode;
+		postcode_info->panel = panel_get(i);
+
+		thread_pool_add_request(backend_thread, backend_delay, (void *)postcode_info);
+	}
 }
 
@@ -7,10 +7,18 @@
 #ifndef _DOMAIN_LOGIC
 #define _DOMAIN_LOGIC
 
-void panel_update_temperature(void);
-void panel_update_frequency(void);
-void panel_update_gpu_temp(void);
-void panel_update_hdd_temp(void);
+#include "options.h"
+
+void panel_set_publish_policy(int request, const PublishPolicy *policy);
+int panel_set_sampling(int request, int window_len, int aggregate);
+void panel_sample(int request);
+void panel_set_core_map(int mode);
+void panel_set_ambient_sensor(int handle);
+
+int panel_update_temperature(unsigned int generation);
+int panel_update_frequency(unsigned int generation);
+int panel_update_gpu_temp(unsigned int generation);
+int panel_update_hdd_temp(unsigned int generation);
 void FP_store_daemon_postcode(void);
 
 #endif	/* _DOMAIN_LOGIC */
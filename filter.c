@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+/*
+ * Incremental filters for noisy sensor readings.
+ *
+ * Each filter keeps a small fixed state, and takes O(1) per sample:
+ * no allocation, so that a filter can be embedded per sensor.
+ * The first sample initializes the filter, and passes through.
+ */
+
+#include <string.h>
+
+#include "filter.h"
+
+
+void filter_init(Filter *f, int kind)
+{
+	memset(f, 0, sizeof(Filter));
+	f->kind = kind;
+}
+
+/* round a fixed-point value to nearest */
+static int ema_round(long ema)
+{
+	if (ema >= 0)
+		return (int)((ema + (1L << (FILTER_EMA_FRAC - 1))) >> FILTER_EMA_FRAC);
+	return -(int)((-ema + (1L << (FILTER_EMA_FRAC - 1))) >> FILTER_EMA_FRAC);
+}
+
+static int filter_ema(Filter *f, int sample)
+{
+	long x = (long)sample << FILTER_EMA_FRAC;
+
+	if (f->count == 1)
+		f->ema = x;
+	else
+		f->ema += (x - f->ema) / (1L << FILTER_EMA_SHIFT);
+
+	return ema_round(f->ema);
+}
+
+/* median of the samples in the window: a fixed-size insertion sort */
+static int filter_median(Filter *f, int sample)
+{
+	int sorted[FILTER_MEDIAN_WINDOW];
+	int n;
+	int i;
+	int j;
+
+	f->samples[f->head] = sample;
+	f->head = (f->head + 1) % FILTER_MEDIAN_WINDOW;
+
+	n = (f->count < FILTER_MEDIAN_WINDOW) ? f->count : FILTER_MEDIAN_WINDOW;
+	for (i = 0; i < n; ++i) {
+		for (j = i; (j > 0) && (sorted[j - 1] > f->samples[i]); --j)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = f->samples[i];
+	}
+
+	/* an even count (while filling up) takes the lower median */
+	return sorted[(n - 1) / 2];
+}
+
+static int filter_rate(Filter *f, int sample)
+{
+	if (f->count == 1)
+		return sample;
+
+	if (sample > f->value + FILTER_RATE_STEP)
+		return f->value + FILTER_RATE_STEP;
+	if (sample < f->value - FILTER_RATE_STEP)
+		return f->value - FILTER_RATE_STEP;
+	return sample;
+}
+
+/*
+ * Feed a sample.
+ * Return:
+ * the filtered value
+ */
+int filter_update(Filter *f, int sample)
+{
+	f->count = (f->count < FILTER_MEDIAN_WINDOW) ? (f->count + 1) : FILTER_MEDIAN_WINDOW;
+
+	switch (f->kind) {
+	case FILTER_EMA:
+		f->value = filter_ema(f, sample);
+		break;
+	case FILTER_MEDIAN:
+		f->value = filter_median(f, sample);
+		break;
+	case FILTER_RATE:
+		f->value = filter_rate(f, sample);
+		break;
+	case FILTER_NONE:
+	default:
+		f->value = sample;
+		break;
+	}
+
+	return f->value;
+}
+
+
+/* unit test */
+int filter_test(void)
+{
+	/* EMA step response 40 -> 60, with a weight of 1/4: 60 - 20 * (3/4)^n */
+	const int ema_step[] = { 45, 49, 52, 54, 55, 56, 57, 58 };
+	/* rate step response 40 -> 60 */
+	const int rate_step[] = { 42, 44, 46, 48, 50, 52, 54, 56, 58, 60, 60 };
+	Filter f;
+	int i;
+	int err = 0;
+
+	/* none: pass through */
+	filter_init(&f, FILTER_NONE);
+	if ((filter_update(&f, 40) != 40) || (filter_update(&f, 90) != 90)) {
+		err = -1;
+		goto test_out;
+	}
+
+	filter_init(&f, FILTER_EMA);
+	if (filter_update(&f, 40) != 40) {
+		err = -2;
+		goto test_out;
+	}
+	for (i = 0; i < sizeof(ema_step) / sizeof(ema_step[0]); ++i) {
+		if (filter_update(&f, 60) != ema_step[i]) {
+			err = -3;
+			goto test_out;
+		}
+	}
+
+	/* EMA impulse response: a single spike of +40 is cut to +10, then decays */
+	filter_init(&f, FILTER_EMA);
+	filter_update(&f, 40);
+	if ((filter_update(&f, 80) != 50) || (filter_update(&f, 40) != 48) ||
+	    (filter_update(&f, 40) != 46)) {
+		err = -4;
+		goto test_out;
+	}
+
+	/* median: an impulse of up to 2 samples is rejected */
+	filter_init(&f, FILTER_MEDIAN);
+	for (i = 0; i < FILTER_MEDIAN_WINDOW; ++i)
+		filter_update(&f, 40);
+	if ((filter_update(&f, 99) != 40) || (filter_update(&f, 99) != 40) ||
+	    (filter_update(&f, 40) != 40)) {
+		err = -5;
+		goto test_out;
+	}
+
+	/* median step response: follows after half the window */
+	filter_init(&f, FILTER_MEDIAN);
+	for (i = 0; i < FILTER_MEDIAN_WINDOW; ++i)
+		filter_update(&f, 40);
+	if ((filter_update(&f, 60) != 40) || (filter_update(&f, 60) != 40) ||
+	    (filter_update(&f, 60) != 60)) {
+		err = -6;
+		goto test_out;
+	}
+
+	filter_init(&f, FILTER_RATE);
+	filter_update(&f, 40);
+	for (i = 0; i < sizeof(rate_step) / sizeof(rate_step[0]); ++i) {
+		if (filter_update(&f, 60) != rate_step[i]) {
+			err = -7;
+			goto test_out;
+		}
+	}
+
+	/* rate impulse response: a spike moves a single step, and falls back */
+	filter_init(&f, FILTER_RATE);
+	filter_update(&f, 40);
+	if ((filter_update(&f, 99) != 42) || (filter_update(&f, 40) != 40) ||
+	    (filter_update(&f, 20) != 38)) {
+		err = -8;
+		goto test_out;
+	}
+
+test_out:
+	return err;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+/*
+ * Incremental filters for noisy sensor readings.
+ */
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+/* EMA weight of a new sample: 1 / 2^FILTER_EMA_SHIFT */
+#define FILTER_EMA_SHIFT		2
+/* fixed-point fraction bits of the EMA state */
+#define FILTER_EMA_FRAC			8
+/* sliding median window [samples] */
+#define FILTER_MEDIAN_WINDOW		5
+/* largest change let through per sample [units] */
+#define FILTER_RATE_STEP		2
+
+/*
+ * NONE   - samples pass through
+ * EMA    - exponential moving average
+ * MEDIAN - median of the last FILTER_MEDIAN_WINDOW samples: rejects impulses
+ * RATE   - rate-of-change limit: follows the samples by FILTER_RATE_STEP at most
+ */
+enum {
+	FILTER_NONE,
+	FILTER_EMA,
+	FILTER_MEDIAN,
+	FILTER_RATE,
+};
+
+typedef struct {
+	int kind;
+	int count;
+	/* last output */
+	int value;
+	/* EMA, in fixed point */
+	long ema;
+	/* MEDIAN: samples in order of arrival (ring) */
+	int head;
+	int samples[FILTER_MEDIAN_WINDOW];
+} Filter;
+
+
+void filter_init(Filter *f, int kind);
+int filter_update(Filter *f, int sample);
+
+int filter_test(void);
+
+#endif	/* _FILTER_H */
@@ -4,7 +4,9 @@
  * License: GNU GPLv2 or later, at your option
  * 
  * Gather some HDD-related information using the S.M.A.R.T. technology. 
- * This code relies on libatasmart.
+ * ATA disks are read through their drivetemp hwmon node if there is one,
+ * or else through libatasmart; NVMe drives are read through their hwmon
+ * node, or their SMART / Health log page.
  */
 
 #include <stdbool.h>
@@ -12,13 +14,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+#include <linux/nvme_ioctl.h>
 #include <atasmart.h>
 
 #include "common.h"
 #include "dlist.h"
+#include "attr-reader.h"
 #include "hdd-info.h"
+#include "stats.h"
 
 
 #define SYS_BLOCK_PATH			"/sys/block"
@@ -27,6 +38,147 @@
 
 DList *smart_devices = NULL;
 
+/* SYS_BLOCK_PATH is kept open, and rescanned when it changes */
+static DIR *sys_block = NULL;
+
+
+/*
+ * Device table
+ *
+ * The ATA disks found under SYS_BLOCK_PATH, each with its SkDisk kept open,
+ * in the order of discovery. The table is only rebuilt when SYS_BLOCK_PATH
+ * changes, so that a steady-state poll costs the SMART reads alone.
+ *
+ * SMART commands may stall behind busy I/O, and wake a sleeping disk.
+ * A disk's reading is reused for the TTL, and a disk in standby is not
+ * read at all: its last reading is reported as stale instead.
+ */
+enum {
+	HDD_TYPE_ATA,
+	HDD_TYPE_NVME,
+};
+
+typedef struct {
+	DListNode dlist_hook;
+	char devname[HDD_DEVNAME_SIZE];
+	int type;			/* HDD_TYPE_* */
+	SkDisk *disk;			/* ATA: kept open; NULL: not open */
+	AttrGroup *attrs;		/* see hdd_sysfs_open() */
+	int nvme_fd;			/* NVMe: for the admin commands; -1: not open */
+	SMARTinfo info;
+	unsigned long long usec;	/* time of the last reading, 0: none */
+	unsigned long long retry_usec;	/* ATA: could not be opened, not before then; 0: none */
+	bool seen;			/* in the current scan */
+} HddDevice;
+
+static DList *hdd_devices = NULL;
+
+/* serializes the HDD poll and the hotplug thread over the table */
+static pthread_mutex_t hdd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the state of SYS_BLOCK_PATH the table was built from */
+static struct {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	int polls;		/* since the last scan */
+	bool rescan;		/* forced, e.g. a disk has gone */
+	bool hotplug;		/* disks are tracked by uevents */
+} sys_block_state = {
+	.rescan = true,
+};
+
+static unsigned long long smart_ttl_usec = ATFP_SMART_CACHE_TTL * 1000ULL;
+
+/*
+ * SMART readings younger than 'msec' milli-seconds are reused (0: never).
+ */
+void hdd_set_smart_ttl(int msec)
+{
+	smart_ttl_usec = (msec > 0) ? (msec * 1000ULL) : 0;
+}
+
+/* the table is walked from the head, in the order of discovery */
+static int hdd_sysfs_open(HddDevice *dev);
+
+static HddDevice *hdd_device_get(const char *devname, int type)
+{
+	DListNode *node;
+	HddDevice *dev;
+
+	for (node = hdd_devices->head; node != NULL; node = node->prev) {
+		dev = (HddDevice *)node;
+		if (!strncmp(dev->devname, devname, HDD_DEVNAME_SIZE))
+			return dev;
+	}
+
+	dev = (HddDevice *)calloc(1, sizeof(HddDevice));
+	if (dev == NULL)
+		return NULL;
+
+	snprintf(dev->devname, HDD_DEVNAME_SIZE, "%s", devname);
+	dev->type = type;
+	dev->nvme_fd = -1;
+	hdd_sysfs_open(dev);
+	dlist_push_back(hdd_devices, dev);
+	return dev;
+}
+
+static void hdd_device_close(HddDevice *dev)
+{
+	if (dev->disk != NULL)
+		sk_disk_free(dev->disk);
+	dev->disk = NULL;
+
+	if (dev->nvme_fd >= 0)
+		close(dev->nvme_fd);
+	dev->nvme_fd = -1;
+}
+
+static void hdd_device_remove(HddDevice *dev)
+{
+	slogi("%s: gone", dev->devname);
+	dlist_remove_node(hdd_devices, dev);
+	hdd_device_close(dev);
+	if (dev->attrs != NULL)
+		attr_group_destroy(dev->attrs);
+	free(dev);
+}
+
+/* forget the disks gone since the last scan */
+static void hdd_devices_purge(void)
+{
+	DListNode *node;
+	DListNode *prev;
+	HddDevice *dev;
+
+	for (node = hdd_devices->head; node != NULL; node = prev) {
+		prev = node->prev;
+		dev = (HddDevice *)node;
+		if (dev->seen) {
+			dev->seen = false;
+			continue;
+		}
+
+		hdd_device_remove(dev);
+	}
+}
+
+/* report a copy of the last reading */
+static void hdd_device_report(HddDevice *dev, DList *hdd_list, bool stale)
+{
+	SMARTinfo *si;
+
+	si = new_SMARTinfo();
+	strncpy(si->devname, dev->devname, HDD_DEVNAME_SIZE);
+	si->temp = dev->info.temp;
+	si->temp_valid = dev->info.temp_valid;
+	si->size_GB = dev->info.size_GB;
+	si->size_valid = dev->info.size_valid;
+	si->stale = stale;
+	dlist_push_back(hdd_list, si);
+}
+
 
 /*
  * SMARTinfo freelist-based memory management
@@ -57,6 +209,7 @@ void delete_SMARTinfo(SMARTinfo *si)
 static void hdd_info_cleanup(void)
 {
 	SMARTinfo *si;
+	HddDevice *dev;
 
 	while ((si = dlist_pop_front(SMARTinfo_freelist)) != NULL)
 		free(si);
@@ -64,14 +217,30 @@ static void hdd_info_cleanup(void)
 	while ((si = dlist_pop_front(smart_devices)) != NULL)
 		free(si);
 
+	while ((dev = dlist_pop_front(hdd_devices)) != NULL) {
+		hdd_device_close(dev);
+		if (dev->attrs != NULL)
+			attr_group_destroy(dev->attrs);
+		free(dev);
+	}
+
 	dlist_destroy(SMARTinfo_freelist);
 	dlist_destroy(smart_devices);
+	dlist_destroy(hdd_devices);
+
+	if (sys_block != NULL)
+		closedir(sys_block);
 }
 
 static void hdd_info_init(void)
 {
 	smart_devices = dlist_create(NULL);
 	SMARTinfo_freelist = dlist_create(NULL);
+	hdd_devices = dlist_create(NULL);
+
+	sys_block = opendir(SYS_BLOCK_PATH);
+	if (sys_block == NULL)
+		sloge("%s: could not open directory: %m", SYS_BLOCK_PATH);
 
 	atexit(hdd_info_cleanup);
 }
@@ -83,22 +252,33 @@ static unsigned int to_celsius(uint64_t millikelvin)
 }
 
 /*
- * Implement visitor pattern on each directory under 'path'.
+ * The type of a block device, by its sysfs path, or -1 if not supported.
+ */
+static int hdd_type(const char *devpath)
+{
+	if (strstr(devpath, "/ata"))
+		return HDD_TYPE_ATA;
+	if (strstr(devpath, "/nvme/"))
+		return HDD_TYPE_NVME;
+
+	return -1;
+}
+
+/*
+ * Implement visitor pattern on each disk under (an open) 'root'.
  */
-static void scan_dirs(const char *path, int (*visitor)(const char *ata_dev, void *arg), void *varg)
+static void scan_dirs(DIR *root, int (*visitor)(const char *devname, int type, void *arg), void *varg)
 {
-	DIR *root;
 	struct dirent *d;
 	char buffer[128];
 	bool keep_searching;
+	int type;
 	int n;
 
-	root = opendir(path);
-	if (root == NULL) {
-		sloge("%s: could not open directory: %m", path);
+	if (root == NULL)
 		return;
-	}
 
+	rewinddir(root);
 	keep_searching = true;
 	while (((d = readdir(root)) != NULL) && keep_searching) {
 		if (!strcmp(".", d->d_name) || !strcmp("..", d->d_name))
@@ -109,42 +289,292 @@ static void scan_dirs(const char *path, int (*visitor)(const char *ata_dev, void
 			continue;
 
 		buffer[n] = '\0';
-		if (!strstr(buffer, "/ata"))
+		type = hdd_type(buffer);
+		if (type < 0)
 			continue;
 
-		keep_searching = visitor(d->d_name, varg);
+		keep_searching = visitor(d->d_name, type, varg);
+	}
+}
+
+static int hdd_device_found(const char *devname, int type, void *arg)
+{
+	HddDevice *dev;
+
+	dev = hdd_device_get(devname, type);
+	if (dev != NULL)
+		dev->seen = true;
+
+	return 1;
+}
+
+/*
+ * Whether SYS_BLOCK_PATH has changed since the last scan.
+ * sysfs does not always update a directory's mtime as entries come and go:
+ * the table is also rescanned every ATFP_HDD_RESCAN_POLLS polls, and
+ * whenever a disk has gone.
+ * With hotplug uevents, the table is kept up to date incrementally,
+ * and only these rescans remain, as a safety net.
+ */
+static bool sys_block_changed(void)
+{
+	struct stat st;
+	bool changed;
+
+	if (sys_block_state.rescan || (++sys_block_state.polls >= ATFP_HDD_RESCAN_POLLS))
+		return true;
+	if (sys_block_state.hotplug)
+		return false;
+
+	if (fstat(dirfd(sys_block), &st) < 0)
+		return true;
+
+	changed = (st.st_dev != sys_block_state.dev) || (st.st_ino != sys_block_state.ino) ||
+		  (st.st_mtim.tv_sec != sys_block_state.mtime.tv_sec) ||
+		  (st.st_mtim.tv_nsec != sys_block_state.mtime.tv_nsec);
+
+	return changed;
+}
+
+static void hdd_devices_update(void)
+{
+	struct stat st;
+
+	if ((sys_block == NULL) || !sys_block_changed())
+		return;
+
+	if (fstat(dirfd(sys_block), &st) == 0) {
+		sys_block_state.dev = st.st_dev;
+		sys_block_state.ino = st.st_ino;
+		sys_block_state.mtime = st.st_mtim;
+	}
+
+	scan_dirs(sys_block, hdd_device_found, NULL);
+	hdd_devices_purge();
+	sys_block_state.polls = 0;
+	sys_block_state.rescan = false;
+}
+
+/*
+ * Sysfs
+ *
+ * The size of every disk, and its temperature if the kernel has a hwmon
+ * node for it: NVMe controllers (kernel 5.5 and up) have one directly
+ * under the device, SATA disks have one under device/hwmon with the
+ * drivetemp driver (kernel 5.6 and up). Reading it is a pread() of an
+ * open attribute, where libatasmart issues a SMART READ DATA command.
+ */
+
+enum {
+	HDD_ATTR_SIZE,		/* 512-byte sectors */
+	HDD_ATTR_TEMP,		/* mdegC, if there is a hwmon node */
+};
+
+/*
+ * Look for 'hwmon*' under 'dir', and add its temperature to the group.
+ */
+static int hdd_sysfs_add_hwmon(AttrGroup *g, const char *dir)
+{
+	char path[ATTR_PATH_SIZE];
+	DIR *d;
+	struct dirent *e;
+	int err = -ENOENT;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return -errno;
+
+	while ((e = readdir(d)) != NULL) {
+		if (strncmp(e->d_name, "hwmon", 5) || !strcmp(e->d_name, "hwmon"))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/temp1_input", dir, e->d_name);
+		err = attr_group_add(g, path, 16);
+		break;
+	}
+	closedir(d);
+
+	return (err < 0) ? err : 0;
+}
+
+/*
+ * The hwmon node may show up after the disk (uevent order, drivetemp loaded
+ * later on): the lookup is retried on every uncached read until it is found.
+ */
+static void hdd_sysfs_lookup_hwmon(HddDevice *dev)
+{
+	char path[ATTR_PATH_SIZE];
+
+	if (dev->type == HDD_TYPE_NVME)
+		snprintf(path, sizeof(path), "%s/%s/device", SYS_BLOCK_PATH, dev->devname);
+	else
+		snprintf(path, sizeof(path), "%s/%s/device/hwmon", SYS_BLOCK_PATH, dev->devname);
+
+	if (hdd_sysfs_add_hwmon(dev->attrs, path) == 0)
+		slogi("%s: temperature from %s", dev->devname, dev->attrs->attr[HDD_ATTR_TEMP].path);
+}
+
+static int hdd_sysfs_open(HddDevice *dev)
+{
+	char path[ATTR_PATH_SIZE];
+
+	dev->attrs = attr_group_create(2);
+	if (dev->attrs == NULL)
+		return -ENOMEM;
+
+	snprintf(path, sizeof(path), "%s/%s/size", SYS_BLOCK_PATH, dev->devname);
+	attr_group_add(dev->attrs, path, 32);
+
+	hdd_sysfs_lookup_hwmon(dev);
+	return 0;
+}
+
+static bool hdd_sysfs_has_temp(HddDevice *dev)
+{
+	return (dev->attrs != NULL) && (dev->attrs->count > HDD_ATTR_TEMP);
+}
+
+/*
+ * Return:
+ * 0 if the temperature was read, -errno otherwise
+ */
+static int hdd_sysfs_read(HddDevice *dev, SMARTinfo *si)
+{
+	AttrGroup *g = dev->attrs;
+	long value;
+	int err = -ENODEV;
+
+	if (g == NULL)
+		return -ENODEV;
+
+	attr_group_read(g);
+
+	if (attr_parse_long(&g->attr[HDD_ATTR_SIZE], &value) == 0) {
+		si->size_GB = (unsigned int)(value >> 21);
+		si->size_valid = true;
+	}
+
+	if (hdd_sysfs_has_temp(dev)) {
+		err = attr_parse_long(&g->attr[HDD_ATTR_TEMP], &value);
+		if (err == 0) {
+			si->temp = (unsigned int)(value / 1000);
+			si->temp_valid = true;
+		}
+	}
+
+	return err;
+}
+
+/*
+ * ATA disk with drivetemp; the caller has checked that the disk is not in
+ * standby, where it could tell, as reading drivetemp issues SMART commands,
+ * which may spin it up.
+ * Return:
+ * 0 on success, -errno to fall back to libatasmart
+ */
+static int drivetemp_get_info(HddDevice *dev, DList *hdd_list, unsigned long long now)
+{
+	SMARTinfo *si;
+	int err;
+
+	si = new_SMARTinfo();
+	strncpy(si->devname, dev->devname, HDD_DEVNAME_SIZE);
+
+	err = hdd_sysfs_read(dev, si);
+	if (err) {
+		slogi("%s: drivetemp: could not read temperature: %s", dev->devname, strerror(-err));
+		delete_SMARTinfo(si);
+		return err;
+	}
+
+	stat_inc_smart_read();
+	dlist_push_back(hdd_list, si);
+
+	dev->info = *si;
+	dev->usec = now;
+	return 0;
+}
+
+/*
+ * Open the ATA disk if needed, and check its power mode, without waking it up.
+ * A disk in standby is reported with its last reading, marked stale.
+ * A disk that could not be opened (e.g. an ATAPI drive) stays in the table,
+ * and the open is retried after ATFP_HDD_OPEN_BACKOFF.
+ * Return:
+ * 0 if the disk is awake (or cannot tell), 1 if reported in standby,
+ * -errno if it is not open
+ */
+static int atasmart_check_standby(HddDevice *dev, DList *hdd_list, unsigned long long now)
+{
+	int err;
+	char device[64];
+	SkBool awake;
+	uint64_t size_B;
+
+	snprintf(device, sizeof(device), "%s/%s", DEV_BLOCK_PATH, dev->devname);
+
+	if (dev->disk == NULL) {
+		if ((dev->retry_usec != 0) && (now < dev->retry_usec))
+			return -EAGAIN;
+
+		err = sk_disk_open(device, &dev->disk);
+		if (err < 0) {
+			err = -errno;
+			if (dev->retry_usec == 0)
+				sloge("%s: could not open: %m", device);
+			else
+				slogd("%s: could not open: %m", device);
+			dev->disk = NULL;
+			dev->retry_usec = now + ATFP_HDD_OPEN_BACKOFF * 1000ULL;
+			return err;
+		}
+		dev->retry_usec = 0;
 	}
 
-	closedir(root);
+	/* a disk that cannot tell is assumed awake */
+	err = sk_disk_check_sleep_mode(dev->disk, &awake);
+	if ((err < 0) || awake)
+		return 0;
+
+	slogd("%s: in standby: SMART not read", device);
+	stat_inc_smart_standby();
+	if (dev->usec == 0) {
+		/* never read: the size is known without waking the disk */
+		dev->info.size_valid = (sk_disk_get_size(dev->disk, &size_B) == 0);
+		dev->info.size_GB = dev->info.size_valid ? (unsigned int)(size_B >> 30) : 0;
+	}
+	hdd_device_report(dev, hdd_list, true);
+	return 1;
 }
 
-static int atasmart_get_info(const char *devname, void *arg)
+/*
+ * The caller has opened the disk, and checked that it is awake.
+ */
+static void atasmart_get_info(HddDevice *dev, DList *hdd_list, unsigned long long now)
 {
 	int err;
 	char device[64];
-	SkDisk *d;
 	SMARTinfo *si;
 	uint64_t mkelvin;
 	uint64_t size_B;
-	DList *hdd_list = (DList *)arg;
 
-	snprintf(device, sizeof(device), "%s/%s", DEV_BLOCK_PATH, devname);
+	snprintf(device, sizeof(device), "%s/%s", DEV_BLOCK_PATH, dev->devname);
 
-	err = sk_disk_open(device, &d);
-	if (err < 0) {
-		sloge("%s: could not open: %m", device);
-		goto gettemp_out0;
-	}
-
-	err = sk_disk_smart_read_data(d);
+	err = sk_disk_smart_read_data(dev->disk);
+	stat_inc_smart_read();
 	if (err < 0) {
 		slogi("%s: could not read SMART data: %m", device);
-		goto gettemp_out1;
+		if ((errno == ENODEV) || (errno == ENXIO)) {
+			/* the disk has gone: reopen, if it is still there */
+			hdd_device_close(dev);
+			sys_block_state.rescan = true;
+		}
+		return;
 	}
 
 	si = new_SMARTinfo();
-	strncpy(si->devname, devname, HDD_DEVNAME_SIZE);
-	err = sk_disk_smart_get_temperature(d, &mkelvin);
+	strncpy(si->devname, dev->devname, HDD_DEVNAME_SIZE);
+	err = sk_disk_smart_get_temperature(dev->disk, &mkelvin);
 	if (err < 0) {
 		slogi("%s: SMART: temperature is not available", device);
 	}
@@ -153,7 +583,7 @@ static int atasmart_get_info(const char *devname, void *arg)
 		si->temp_valid = true;
 	}
 
-	err = sk_disk_get_size(d, &size_B);
+	err = sk_disk_get_size(dev->disk, &size_B);
 	if (err < 0) {
 		slogi("%s: SMART: size is not available", device);
 	}
@@ -163,20 +593,425 @@ static int atasmart_get_info(const char *devname, void *arg)
 	}
 	dlist_push_back(hdd_list, si);
 
-gettemp_out1:
-	sk_disk_free(d);
+	dev->info = *si;
+	dev->usec = now;
+}
 
-gettemp_out0:
-	return 1;
+
+/*
+ * NVMe
+ *
+ * The composite temperature is read from the controller's hwmon node,
+ * or else from the SMART / Health log page, through an admin command.
+ */
+
+#define NVME_ADMIN_GET_LOG_PAGE		0x02
+#define NVME_LOG_SMART			0x02
+#define NVME_NSID_ALL			0xffffffff
+#define NVME_LOG_SMART_SIZE		512
+
+/*
+ * Read the composite temperature from the SMART / Health log page.
+ */
+static int nvme_read_smart_log(HddDevice *dev, unsigned int *temp)
+{
+	char device[64];
+	unsigned char log[NVME_LOG_SMART_SIZE];
+	struct nvme_admin_cmd cmd = {
+		.opcode		= NVME_ADMIN_GET_LOG_PAGE,
+		.nsid		= NVME_NSID_ALL,
+		.addr		= (unsigned long)log,
+		.data_len	= sizeof(log),
+		/* number of dwords (0's based), log page id */
+		.cdw10		= (((sizeof(log) / 4) - 1) << 16) | NVME_LOG_SMART,
+	};
+	unsigned int kelvin;
+
+	if (dev->nvme_fd < 0) {
+		snprintf(device, sizeof(device), "%s/%s", DEV_BLOCK_PATH, dev->devname);
+		dev->nvme_fd = open(device, O_RDONLY | O_CLOEXEC);
+		if (dev->nvme_fd < 0) {
+			sloge("%s: could not open: %m", device);
+			return -errno;
+		}
+	}
+
+	if (ioctl(dev->nvme_fd, NVME_IOCTL_ADMIN_CMD, &cmd) != 0) {
+		slogi("%s: could not read SMART log: %m", dev->devname);
+		return -EIO;
+	}
+
+	/* composite temperature [K], bytes 1..2, little endian */
+	kelvin = log[1] | (log[2] << 8);
+	if (kelvin == 0)
+		return -ENODATA;
+
+	*temp = kelvin - 273;
+	return 0;
+}
+
+static void nvme_get_info(HddDevice *dev, DList *hdd_list, unsigned long long now)
+{
+	SMARTinfo *si;
+
+	stat_inc_smart_read();
+
+	si = new_SMARTinfo();
+	strncpy(si->devname, dev->devname, HDD_DEVNAME_SIZE);
+
+	if (hdd_sysfs_read(dev, si) != 0) {
+		if (nvme_read_smart_log(dev, &si->temp) == 0)
+			si->temp_valid = true;
+		else
+			slogi("%s: temperature is not available", dev->devname);
+	}
+
+	dlist_push_back(hdd_list, si);
+
+	dev->info = *si;
+	dev->usec = now;
+}
+
+static void hdd_device_read(HddDevice *dev, DList *hdd_list)
+{
+	unsigned long long now = clock_monotonic_usec();
+	int err;
+
+	if ((dev->usec != 0) && (now - dev->usec < smart_ttl_usec)) {
+		stat_inc_smart_cached();
+		hdd_device_report(dev, hdd_list, false);
+		return;
+	}
+
+	if ((dev->attrs != NULL) && !hdd_sysfs_has_temp(dev))
+		hdd_sysfs_lookup_hwmon(dev);
+
+	switch (dev->type) {
+	case HDD_TYPE_NVME:
+		nvme_get_info(dev, hdd_list, now);
+		break;
+	case HDD_TYPE_ATA:
+	default:
+		/*
+		 * Both drivetemp and libatasmart may wake a disk up: only a disk
+		 * known to be in standby is skipped. drivetemp needs no open disk.
+		 */
+		err = atasmart_check_standby(dev, hdd_list, now);
+		if (err > 0)
+			break;
+
+		if (hdd_sysfs_has_temp(dev) && (drivetemp_get_info(dev, hdd_list, now) == 0))
+			break;
+
+		if (err == 0)
+			atasmart_get_info(dev, hdd_list, now);
+		break;
+	}
 }
 
 
 void hdd_get_temperature(DList **sd)
 {
+	DListNode *node;
+
 	if (smart_devices == NULL)
 		hdd_info_init();
 
-	scan_dirs(SYS_BLOCK_PATH, atasmart_get_info, smart_devices);
+	pthread_mutex_lock(&hdd_lock);
+	hdd_devices_update();
+	for (node = hdd_devices->head; node != NULL; node = node->prev)
+		hdd_device_read((HddDevice *)node, smart_devices);
+	pthread_mutex_unlock(&hdd_lock);
+
 	*sd = smart_devices;
 }
 
+
+/*
+ * Hotplug
+ *
+ * A thread listens to the kernel uevents of block devices, and adds
+ * or removes ATA disks to/from the table as they come and go.
+ * The uevent source is any datagram socket: a NETLINK_KOBJECT_UEVENT
+ * socket, or one end of a socketpair in the unit test.
+ */
+
+#define UEVENT_BUF_SIZE			4096
+
+static struct {
+	int fd;
+	pthread_t thread;
+	bool running;
+	void (*notify)(void);
+} hotplug = {
+	.fd = -1,
+};
+
+static int uevent_open(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family	= AF_NETLINK,
+		.nl_groups	= 1,	/* kernel uevents */
+	};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -errno;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	return fd;
+}
+
+/*
+ * Apply a uevent: "ACTION@DEVPATH", followed by KEY=VALUE fields,
+ * each NUL-terminated.
+ * Return:
+ * true if the table has changed
+ */
+static bool uevent_apply(const char *buf, int len)
+{
+	const char *action = NULL;
+	const char *devpath = NULL;
+	const char *devname = NULL;
+	const char *subsystem = NULL;
+	const char *devtype = NULL;
+	const char *end = buf + len;
+	const char *field;
+	HddDevice *dev;
+	bool changed = false;
+	bool add;
+	int type;
+
+	for (field = buf; field < end; field += strnlen(field, end - field) + 1) {
+		if (!strncmp(field, "ACTION=", 7))
+			action = field + 7;
+		else if (!strncmp(field, "DEVPATH=", 8))
+			devpath = field + 8;
+		else if (!strncmp(field, "DEVNAME=", 8))
+			devname = field + 8;
+		else if (!strncmp(field, "SUBSYSTEM=", 10))
+			subsystem = field + 10;
+		else if (!strncmp(field, "DEVTYPE=", 8))
+			devtype = field + 8;
+	}
+
+	if ((action == NULL) || (devpath == NULL) || (devname == NULL) ||
+	    (subsystem == NULL) || strcmp(subsystem, "block") ||
+	    (devtype == NULL) || strcmp(devtype, "disk"))
+		return false;
+
+	type = hdd_type(devpath);
+	if (type < 0)
+		return false;
+
+	if (!strcmp(action, "add"))
+		add = true;
+	else if (!strcmp(action, "remove"))
+		add = false;
+	else
+		return false;
+
+	pthread_mutex_lock(&hdd_lock);
+	if (add) {
+		changed = (hdd_device_get(devname, type) != NULL);
+		slogi("%s: added", devname);
+	}
+	else {
+		for (dev = (HddDevice *)hdd_devices->head; dev != NULL; dev = (HddDevice *)dev->dlist_hook.prev) {
+			if (!strncmp(dev->devname, devname, HDD_DEVNAME_SIZE)) {
+				hdd_device_remove(dev);
+				changed = true;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&hdd_lock);
+
+	return changed;
+}
+
+static void *hotplug_thread(void *arg)
+{
+	char buf[UEVENT_BUF_SIZE];
+	struct sockaddr_nl addr;
+	socklen_t addrlen;
+	ssize_t n;
+
+	/* cancelled while waiting for a uevent only, never while holding the table */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	for (;;) {
+		addrlen = sizeof(addr);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		n = recvfrom(hotplug.fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&addr, &addrlen);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				/* uevents were lost: fall back to a scan */
+				slogw("hotplug: uevents lost: rescan");
+				pthread_mutex_lock(&hdd_lock);
+				sys_block_state.rescan = true;
+				pthread_mutex_unlock(&hdd_lock);
+				if (hotplug.notify != NULL)
+					hotplug.notify();
+				continue;
+			}
+			sloge("hotplug: could not receive: %m");
+			break;
+		}
+		if (n == 0)
+			break;
+
+		/* netlink: only the kernel is trusted */
+		if ((addrlen == sizeof(addr)) && (addr.nl_family == AF_NETLINK) && (addr.nl_pid != 0))
+			continue;
+
+		buf[n] = '\0';
+		if (uevent_apply(buf, n) && (hotplug.notify != NULL))
+			hotplug.notify();
+	}
+
+	return NULL;
+}
+
+/*
+ * Track the disks by hotplug uevents read from 'fd' (-1: the kernel),
+ * calling 'notify' (optional) whenever the table has changed.
+ */
+int hdd_hotplug_start(int fd, void (*notify)(void))
+{
+	int err;
+
+	if (smart_devices == NULL)
+		hdd_info_init();
+
+	if (fd < 0) {
+		fd = uevent_open();
+		if (fd < 0) {
+			slogw("hotplug: could not open uevent socket: %d: periodic rescans only", fd);
+			return fd;
+		}
+	}
+
+	hotplug.fd = fd;
+	hotplug.notify = notify;
+	err = pthread_create(&hotplug.thread, NULL, hotplug_thread, NULL);
+	if ( err ) {
+		close(fd);
+		hotplug.fd = -1;
+		return -err;
+	}
+
+	hotplug.running = true;
+	pthread_mutex_lock(&hdd_lock);
+	sys_block_state.hotplug = true;
+	pthread_mutex_unlock(&hdd_lock);
+	return 0;
+}
+
+void hdd_hotplug_stop(void)
+{
+	if ( !hotplug.running )
+		return;
+
+	pthread_cancel(hotplug.thread);
+	pthread_join(hotplug.thread, NULL);
+	close(hotplug.fd);
+	hotplug.fd = -1;
+	hotplug.running = false;
+
+	pthread_mutex_lock(&hdd_lock);
+	sys_block_state.hotplug = false;
+	pthread_mutex_unlock(&hdd_lock);
+}
+
+
+/* unit test: uevents through a socketpair */
+static int hotplug_test_notified;
+
+static void hotplug_test_notify(void)
+{
+	__sync_fetch_and_add(&hotplug_test_notified, 1);
+}
+
+static bool hotplug_test_has(const char *devname)
+{
+	HddDevice *dev;
+	bool found = false;
+
+	pthread_mutex_lock(&hdd_lock);
+	for (dev = (HddDevice *)hdd_devices->head; dev != NULL; dev = (HddDevice *)dev->dlist_hook.prev) {
+		if (!strcmp(dev->devname, devname))
+			found = true;
+	}
+	pthread_mutex_unlock(&hdd_lock);
+
+	return found;
+}
+
+/* send a uevent, and wait until the table has changed */
+static int hotplug_test_send(int fd, const char *action, const char *devpath, const char *devname,
+			     const char *subsystem, int notified)
+{
+	char buf[512];
+	int len;
+	int i;
+
+	len = snprintf(buf, sizeof(buf), "%s@%s", action, devpath) + 1;
+	len += snprintf(&buf[len], sizeof(buf) - len, "ACTION=%s", action) + 1;
+	len += snprintf(&buf[len], sizeof(buf) - len, "DEVPATH=%s", devpath) + 1;
+	len += snprintf(&buf[len], sizeof(buf) - len, "SUBSYSTEM=%s", subsystem) + 1;
+	len += snprintf(&buf[len], sizeof(buf) - len, "DEVNAME=%s", devname) + 1;
+	len += snprintf(&buf[len], sizeof(buf) - len, "DEVTYPE=disk") + 1;
+	if (send(fd, buf, len, 0) != len)
+		return -1;
+
+	for (i = 0; (i < 100) && (__sync_fetch_and_add(&hotplug_test_notified, 0) < notified); ++i)
+		usleep(10000);
+
+	return 0;
+}
+
+int hdd_hotplug_test(void)
+{
+	const char *ata = "/devices/pci0000:00/0000:00:1f.2/ata3/host2/target2:0:0/2:0:0:0/block/sdx";
+	const char *usb = "/devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1:1.0/host6/block/sdy";
+	int sv[2];
+	int err = 0;
+
+	hotplug_test_notified = 0;
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0)
+		return -1;
+
+	if (hdd_hotplug_start(sv[1], hotplug_test_notify)) {
+		close(sv[0]);
+		close(sv[1]);
+		return -2;
+	}
+
+	hotplug_test_send(sv[0], "add", ata, "sdx", "block", 1);
+	if ((hotplug_test_notified != 1) || !hotplug_test_has("sdx")) {
+		err = -3;
+		goto test_out;
+	}
+
+	/* not an ATA disk, and not a block device: ignored (uevents are handled in order) */
+	hotplug_test_send(sv[0], "add", usb, "sdy", "block", 1);
+	hotplug_test_send(sv[0], "remove", ata, "sdx", "scsi", 1);
+	hotplug_test_send(sv[0], "remove", ata, "sdx", "block", 2);
+	if ((hotplug_test_notified != 2) || hotplug_test_has("sdx") || hotplug_test_has("sdy")) {
+		err = -4;
+		goto test_out;
+	}
+
+test_out:
+	close(sv[0]);
+	hdd_hotplug_stop();
+	return err;
+}
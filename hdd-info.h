@@ -3,7 +3,7 @@
  * Author: Andrey Gelman <andrey.gelman@compulab.co.il>
  * License: GNU GPLv2 or later, at your option
  *
- * This code relies on libatasmart.
+ * ATA disks are read through drivetemp where available, else libatasmart.
  */
 
 #ifndef _HDD_TEMP_H
@@ -12,7 +12,7 @@
 #include "dlist.h"
 
 
-#define HDD_DEVNAME_SIZE		8
+#define HDD_DEVNAME_SIZE		16
 
 
 typedef struct {
@@ -22,6 +22,7 @@ typedef struct {
 	unsigned int size_GB;	/* GB */
 	bool temp_valid;
 	bool size_valid;
+	bool stale;		/* the disk sleeps: the last reading taken awake */
 
 } SMARTinfo;
 
@@ -29,7 +30,13 @@ typedef struct {
 SMARTinfo *new_SMARTinfo(void);
 void delete_SMARTinfo(SMARTinfo *si);
 
+void hdd_set_smart_ttl(int msec);
 void hdd_get_temperature(DList **sd);
 
+int hdd_hotplug_start(int fd, void (*notify)(void));
+void hdd_hotplug_stop(void);
+
+int hdd_hotplug_test(void);
+
 #endif	/* _HDD_TEMP_H */
 
@@ -15,6 +15,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/time.h>
 #include <sensors/sensors.h>
 
 #include "common.h"
@@ -27,27 +28,157 @@
 #include "vga-tools.h"
 #include "hdd-info.h"
 #include "options.h"
+#include "attr-reader.h"
+#include "cpu-freq.h"
+#include "filter.h"
 
 
-ThreadPool *frontend_thread;
 ThreadPool *backend_thread;
 
+static ThreadPool *scheduler_thread;
 static InProcessingBitmap in_processing = {0};
 static Options options;
 
+/* requests to be dispatched on the next run of main_thread, regardless of their schedule */
+static long poll_now;
+
+/*
+ * Per request schedule [mSec, monotonic]; accessed by main_thread only,
+ * which runs on the single scheduler_thread, hence no locking.
+ */
+static struct {
+	unsigned long long due[ATFP_NUM_REQUESTS];
+	unsigned long long sample_due[ATFP_NUM_REQUESTS];
+} schedule;
+
+/*
+ * Self-pipe: each byte written is an event for the wake-up thread, which
+ * handles it in an ordinary thread context (signal handlers only post).
+ * The write end is non-blocking: a full pipe already holds pending events.
+ */
+#define WAKEUP_SCHEDULER		'a'	/* queue a run of main_thread */
+#define WAKEUP_SHOW_STATS		's'	/* SIGUSR1: show statistics, dump the i2c trace */
+
+static int wakeup_pipe[2] = {-1, -1};
+static pthread_t wakeup_thread;
+
 static void main_thread(void *priv_context, void *shared_context);
+static void hdd_hotplug_notify(void);
+
+
+/*
+ * Post a WAKEUP_* event; async-signal-safe.
+ */
+static void wakeup_post(char event)
+{
+	int saved_errno = errno;
+	ssize_t n;
+
+	n = write(wakeup_pipe[1], &event, 1);
+	(void)n;
+	errno = saved_errno;
+}
+
+static void scheduler_wakeup(void)
+{
+	wakeup_post(WAKEUP_SCHEDULER);
+}
+
+static void show_stats(void)
+{
+	int i;
+
+	stat_show();
+	thread_pool_show(scheduler_thread, "scheduler");
+	thread_pool_show(backend_thread, "backend");
+	for (i = 0; i < panel_count(); ++i)
+		thread_pool_show(panel_frontend(panel_get(i)), "frontend");
+	panel_trace_show();
+	if (options.i2c_trace_file[0] != '\0')
+		panel_trace_dump(options.i2c_trace_file);
+}
+
+/*
+ * Handle the posted events, each kind once per batch:
+ * main_thread is queued rather than run, so that the watchdog covers it.
+ */
+static void *scheduler_wakeup_thread(void *arg)
+{
+	char buf[64];
+	bool schedule;
+	bool stats;
+	ssize_t n;
+	int i;
+
+	while ( 1 ) {
+		n = read(wakeup_pipe[0], buf, sizeof(buf));
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n <= 0)
+			break;
+
+		schedule = stats = false;
+		for (i = 0; i < n; ++i) {
+			schedule |= (buf[i] == WAKEUP_SCHEDULER);
+			stats |= (buf[i] == WAKEUP_SHOW_STATS);
+		}
+
+		if (stats)
+			show_stats();
+		if (schedule)
+			thread_pool_add_request(scheduler_thread, main_thread, NULL);
+	}
+
+	return NULL;
+}
+
+static int scheduler_wakeup_init(void)
+{
+	int err;
+
+	if (pipe(wakeup_pipe)) {
+		sloge("could not create the wake-up pipe: %m");
+		return -errno;
+	}
+	fcntl(wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+	err = pthread_create(&wakeup_thread, NULL, scheduler_wakeup_thread, NULL);
+	if ( err ) {
+		sloge("could not spawn the wake-up thread: %d", err);
+		close(wakeup_pipe[0]);
+		close(wakeup_pipe[1]);
+		wakeup_pipe[0] = wakeup_pipe[1] = -1;
+		return -err;
+	}
+
+	return 0;
+}
+
+static void scheduler_wakeup_cleanup(void)
+{
+	if (wakeup_pipe[0] < 0)
+		return;
+
+	/* read() is a cancellation point */
+	pthread_cancel(wakeup_thread);
+	pthread_join(wakeup_thread, NULL);
+	close(wakeup_pipe[0]);
+	close(wakeup_pipe[1]);
+	wakeup_pipe[0] = wakeup_pipe[1] = -1;
+}
 
 
 static void signal_handler(int signo)
 {
 	switch (signo)
 	{
+	/* only async-signal-safe calls here: the work is done by the wake-up thread */
 	case SIGALRM:
-		thread_pool_add_request(frontend_thread, main_thread, NULL);
+		scheduler_wakeup();
 		break;
 
 	case SIGUSR1:
-		stat_show();
+		wakeup_post(WAKEUP_SHOW_STATS);
 		break;
 
 	case SIGUSR2:
@@ -129,37 +260,86 @@ static void daemonize(void)
 static void initialize(void)
 {
 	int err;
+	int i;
 
 	/* set up logging */
 	openlog(ATFP_SYSLOG_IDENT, LOG_PID, LOG_USER);
 	setlogmask(LOG_UPTO(options.loglevel));
 
+	/* poll jitter */
+	srand(getpid());
+
 	install_sighandler(SIGALRM);
 	install_sighandler(SIGUSR1);
 	install_sighandler(SIGUSR2);
 	daemon_termination(DTERM_INIT);
-	err = panel_open_i2c(options.i2c_bus, I2C_PANEL_INTERFACE_ADDR, options.i2c_delay);
+	for (i = 0; i < options.i2c_bus_num; ++i) {
+		err = panel_open_i2c(options.i2c_bus[i], I2C_PANEL_INTERFACE_ADDR, options.i2c_delay[i]);
+		if ( err )
+			exit(1);
+		err = panel_reset(panel_get(i));
+		if ( err )
+			exit(1);
+	}
+
+	attr_reader_set_batch(options.attr_read_batch);
+	cpu_freq_set_source(options.cpufreq_source);
+	panel_set_core_map(options.core_map);
+	sensors_set_cache_ttl(options.sensor_ttl);
+	hdd_set_smart_ttl(options.smart_ttl);
+	sensors_set_filter(options.filter[ATFP_OFFS_PENDR0_CPUTR]);
+	gpu_set_filter(options.filter[ATFP_OFFS_PENDR0_GPUTR]);
+	if ((options.filter[ATFP_OFFS_PENDR0_HDDTR] != FILTER_NONE) ||
+	    (options.filter[ATFP_OFFS_PENDR0_CPUFR] != FILTER_NONE))
+		slogw("filters are supported for CPUTR and GPUTR only: ignored");
+
+	err = sensors_coretemp_init();
 	if ( err )
 		exit(1);
-	err = panel_reset();
+
+	if (options.ambient_sensor[0] != '\0')
+		panel_set_ambient_sensor(sensors_hwmon_add(options.ambient_sensor));
+
+	gpu_sensors_init(options.gpu_sensor);
+
+	for (i = 0; i < ATFP_NUM_REQUESTS; ++i) {
+		panel_set_publish_policy(i, &options.publish[i]);
+
+		if (options.sample_interval[i] <= 0)
+			continue;
+		err = panel_set_sampling(i, options.poll_interval[i] / options.sample_interval[i],
+					 options.aggregate[i]);
+		if ( err ) {
+			slogw("sampling is not supported for request %d: ignored", i);
+			options.sample_interval[i] = 0;
+		}
+		else if (options.sample_interval[i] < options.sensor_ttl) {
+			slogw("request %d: sample interval is below sensor-ttl: samples repeat cached readings", i);
+		}
+	}
+
+	err = panel_create_frontends(ATFP_FRONTEND_QUEUE_LEN);
 	if ( err )
 		exit(1);
-
-	err = sensors_coretemp_init();
+	backend_thread = thread_pool_create(ATFP_BACKEND_THREAD_NUM, ATFP_BACKEND_QUEUE_LEN, &in_processing);
+	/* a single thread: runs of main_thread never overlap */
+	scheduler_thread = thread_pool_create(1, ATFP_SCHEDULER_QUEUE_LEN, &in_processing);
+	thread_pool_set_overflow(scheduler_thread, THREAD_POOL_OVERFLOW_REPLACE);
+	err = scheduler_wakeup_init();
 	if ( err )
 		exit(1);
 
-	gpu_sensors_init();
-
-	frontend_thread = thread_pool_create(1, ATFP_FRONTEND_QUEUE_LEN, &in_processing);
-	backend_thread = thread_pool_create(ATFP_BACKEND_THREAD_NUM, ATFP_BACKEND_QUEUE_LEN, NULL);
+	if ( !(options.disable & ATFP_MASK_PENDR0_HDDTR) )
+		hdd_hotplug_start(-1, hdd_hotplug_notify);
 }
 
 static void cleanup(void)
 {
-	thread_pool_join(frontend_thread);
+	hdd_hotplug_stop();
+	scheduler_wakeup_cleanup();
+	thread_pool_destroy(scheduler_thread);
 	thread_pool_destroy(backend_thread);
-	thread_pool_destroy(frontend_thread);
+	panel_destroy_frontends();
 
 	panel_close();
 	sensors_cleanup();
@@ -198,71 +378,273 @@ static void show_info_and_exit(void)
 
 #define UNSUPPORTED_REQ_MESSAGE(r)	do { slogw("%s: "#r" request is not supported", __FUNCTION__); } while (0)
 
-void in_processing_add_request(long request, InProcessingBitmap *processing)
+/*
+ * Requests are added by main_thread and removed by the backend tasks
+ * once their result is read, hence the bitmap is updated atomically.
+ * Adding a request returns the generation the backend task must present
+ * on completion.
+ */
+unsigned int in_processing_add_request(long request, InProcessingBitmap *processing)
 {
-	processing->bitmap |= request;
+	int i = __builtin_ctzl(request);
+	unsigned int generation;
+
+	generation = __atomic_load_n(&processing->generation[i], __ATOMIC_ACQUIRE);
+	__atomic_store_n(&processing->since[i], clock_monotonic_usec() / 1000, __ATOMIC_RELAXED);
+	__sync_fetch_and_or(&processing->bitmap, request);
+
+	return generation;
 }
 
-void in_processing_remove_request(long request, InProcessingBitmap *processing)
+/*
+ * Return:
+ * true if 'generation' is current and the request is removed,
+ * false for a stale completion (the request has been reclaimed meanwhile)
+ */
+bool in_processing_remove_request(long request, unsigned int generation, InProcessingBitmap *processing)
 {
-	processing->bitmap &= ~request;
+	int i = __builtin_ctzl(request);
+
+	if ( !__sync_bool_compare_and_swap(&processing->generation[i], generation, generation + 1) ) {
+		stat_inc_stale(i);
+		return false;
+	}
+
+	__sync_fetch_and_and(&processing->bitmap, ~request);
+	return true;
+}
+
+/*
+ * Return:
+ * true if 'generation' is current, i.e. the request has not been reclaimed;
+ * the request stays in processing
+ */
+bool in_processing_is_current(long request, unsigned int generation, InProcessingBitmap *processing)
+{
+	int i = __builtin_ctzl(request);
+
+	return __atomic_load_n(&processing->generation[i], __ATOMIC_ACQUIRE) == generation;
 }
 
 long in_processing_get_bitmap(InProcessingBitmap *processing)
 {
-	return processing->bitmap;
+	return __sync_fetch_and_or(&processing->bitmap, 0L);
+}
+
+/*
+ * Reclaim a request in processing for longer than 'timeout' mSec:
+ * its task is either lost or stuck, and would otherwise block the request forever.
+ * Return:
+ * 1 if reclaimed, 0 otherwise
+ */
+int in_processing_reclaim(long request, unsigned long long timeout, InProcessingBitmap *processing)
+{
+	int i = __builtin_ctzl(request);
+	unsigned int generation;
+	unsigned long long now;
+
+	if ( !(in_processing_get_bitmap(processing) & request) )
+		return 0;
+
+	generation = __atomic_load_n(&processing->generation[i], __ATOMIC_ACQUIRE);
+	now = clock_monotonic_usec() / 1000;
+	if (now - __atomic_load_n(&processing->since[i], __ATOMIC_RELAXED) < timeout)
+		return 0;
+
+	/* the task might complete right now: whoever bumps the generation first wins */
+	if ( !__sync_bool_compare_and_swap(&processing->generation[i], generation, generation + 1) )
+		return 0;
+
+	__sync_fetch_and_and(&processing->bitmap, ~request);
+	stat_inc_reclaimed(i);
+	return 1;
+}
+
+
+/* unit test */
+int in_processing_test(void)
+{
+	InProcessingBitmap processing = {0};
+	long request = ATFP_MASK_PENDR0_CPUTR;
+	int i = ATFP_OFFS_PENDR0_CPUTR;
+	unsigned int generation;
+	unsigned int next;
+	int err = 0;
+
+	/* completed in time: still in processing, i.e. not dispatched again, until removed */
+	generation = in_processing_add_request(request, &processing);
+	if (in_processing_reclaim(request, ATFP_STUCK_TIMEOUT, &processing) != 0) {
+		err = -1;
+		goto test_out;
+	}
+	if ( !in_processing_is_current(request, generation, &processing) ||
+	     !(in_processing_get_bitmap(&processing) & request) ) {
+		err = -6;
+		goto test_out;
+	}
+	if ( !in_processing_remove_request(request, generation, &processing) ||
+	     (in_processing_get_bitmap(&processing) & request) ) {
+		err = -2;
+		goto test_out;
+	}
+
+	/* stuck: reclaimed, then its late completion is stale */
+	generation = in_processing_add_request(request, &processing);
+	processing.since[i] -= ATFP_STUCK_TIMEOUT;
+	if ((in_processing_reclaim(request, ATFP_STUCK_TIMEOUT, &processing) != 1) ||
+	    (in_processing_get_bitmap(&processing) & request)) {
+		err = -3;
+		goto test_out;
+	}
+
+	next = in_processing_add_request(request, &processing);
+	if (in_processing_is_current(request, generation, &processing) ||
+	    !in_processing_is_current(request, next, &processing) ||
+	    in_processing_remove_request(request, generation, &processing)) {
+		err = -4;
+		goto test_out;
+	}
+	if ( !in_processing_remove_request(request, next, &processing) )
+		err = -5;
+
+test_out:
+	return err;
+}
+
+/*
+ * Arm SIGALRM to fire in 'msec' milli-seconds.
+ */
+static void main_thread_schedule(unsigned long long msec)
+{
+	struct itimerval timer = {{0}};
+
+	if (msec == 0)
+		msec = 1;
+
+	timer.it_value.tv_sec = msec / 1000;
+	timer.it_value.tv_usec = (msec % 1000) * 1000;
+	setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/*
+ * A disk has been plugged or unplugged: poll HDDTR right away.
+ * The bit is set (a full barrier) before the wake-up, hence the run of
+ * main_thread it queues sees it; a run already in progress may consume
+ * it first, and the queued run then just follows the schedule.
+ */
+static void hdd_hotplug_notify(void)
+{
+	__sync_fetch_and_or(&poll_now, ATFP_MASK_PENDR0_HDDTR);
+	scheduler_wakeup();
 }
 
+/*
+ * Main loop: a scheduler dispatching each request when it is due.
+ * Each request has its own poll interval, extended by a random jitter.
+ * A request still being processed when it is due skips this poll interval.
+ * A request in processing for ATFP_STUCK_TIMEOUT is reclaimed, whether due
+ * or not: the scheduler runs again by then.
+ * Requests with a sample interval are also sampled in between polls.
+ * Runs on scheduler_thread only, one run at a time.
+ */
 static void main_thread(void *priv_context, void *shared_context)
 {
-	int i;
+	unsigned long long *due = schedule.due;
+	unsigned long long *sample_due = schedule.sample_due;
+	InProcessingBitmap *processing = (InProcessingBitmap *)shared_context;
+	unsigned long long now;
+	unsigned long long next;
+	unsigned long long stuck;
+	unsigned int generation;
 	long request_bitmap;
+	long now_bitmap;
 	long request;
-	InProcessingBitmap *processing = (InProcessingBitmap *)shared_context;
+	int err;
+	int i;
 
+	now_bitmap = __sync_fetch_and_and(&poll_now, 0L);
 	request_bitmap = ATFP_MASK_PENDR0_HDDTR | ATFP_MASK_PENDR0_CPUFR |
 			 ATFP_MASK_PENDR0_CPUTR | ATFP_MASK_PENDR0_GPUTR;
 
 	/* (optionally) disable particular functions */
 	request_bitmap &= ~options.disable;
 
-	/* ignore requests currently being processed */
-	request_bitmap &= ~in_processing_get_bitmap(processing);
+	now = clock_monotonic_usec() / 1000;
+	next = now + (ATFP_MAIN_POLL_CYCLE * 1000);
 
-	/* dispatch each request */
-	for (i = 0; i < (sizeof(request_bitmap) * 8); ++i) {
+	/* dispatch each request being due */
+	for (i = 0; i < ATFP_NUM_REQUESTS; ++i) {
 		request = request_bitmap & (1L << i);
-		in_processing_add_request(request, processing);
-		switch (request) {
-		case 0:
-			/* no pending requests */
-			break;
-
-		case ATFP_MASK_PENDR0_HDDTR:
-			panel_update_hdd_temp();
-			break;
-
-		case ATFP_MASK_PENDR0_CPUFR:
-			panel_update_frequency();
-			break;
+		if (request == 0)
+			continue;
+
+		if (options.sample_interval[i] > 0) {
+			if (now >= sample_due[i]) {
+				sample_due[i] = now + options.sample_interval[i];
+				panel_sample(i);
+			}
+			if (sample_due[i] < next)
+				next = sample_due[i];
+		}
 
-		case ATFP_MASK_PENDR0_CPUTR:
-			panel_update_temperature();
-			break;
+		if (in_processing_reclaim(request, ATFP_STUCK_TIMEOUT, processing))
+			slogw("request %d: reclaimed after %d mSec in processing", i, ATFP_STUCK_TIMEOUT);
+
+		if ((now >= due[i]) || (now_bitmap & request)) {
+			due[i] = now + options.poll_interval[i];
+			if (options.poll_jitter[i] > 0)
+				due[i] += rand() % options.poll_jitter[i];
+
+			/* ignore requests currently being processed; an immediate poll is retried */
+			if (in_processing_get_bitmap(processing) & request) {
+				stat_inc_skipped(i);
+				if (now_bitmap & request)
+					__sync_fetch_and_or(&poll_now, request);
+			}
+			else {
+				generation = in_processing_add_request(request, processing);
+				switch (request) {
+				case ATFP_MASK_PENDR0_HDDTR:
+					err = panel_update_hdd_temp(generation);
+					break;
+
+				case ATFP_MASK_PENDR0_CPUFR:
+					err = panel_update_frequency(generation);
+					break;
+
+				case ATFP_MASK_PENDR0_CPUTR:
+					err = panel_update_temperature(generation);
+					break;
+
+				case ATFP_MASK_PENDR0_GPUTR:
+					err = panel_update_gpu_temp(generation);
+					break;
+
+				default:
+					/* 'request' should not be added in the first place */
+					err = -EINVAL;
+					break;
+				}
+
+				/* not dispatched: the request is not in processing */
+				if ( err )
+					in_processing_remove_request(request, generation, processing);
+			}
+		}
 
-		case ATFP_MASK_PENDR0_GPUTR:
-			panel_update_gpu_temp();
-			break;
+		if (due[i] < next)
+			next = due[i];
 
-		default:
-			/* 'request' should not be added in the first place */
-			in_processing_remove_request(request, processing);
-			break;
+		/* be back in time to reclaim it */
+		if (in_processing_get_bitmap(processing) & request) {
+			stuck = __atomic_load_n(&processing->since[i], __ATOMIC_RELAXED) + ATFP_STUCK_TIMEOUT;
+			if ((stuck > now) && (stuck < next))
+				next = stuck;
 		}
 	}
 
 	/* program our next appearance */
-	alarm(options.poll_cycle);
+	main_thread_schedule(next - now);
 }
 
 
@@ -273,8 +655,8 @@ int main(int argc, char *argv[])
 		show_info_and_exit();
 
 	if ( !options.i2c_bus_set ) {
-		options.i2c_bus = panel_lookup_i2c_bus();
-		if (options.i2c_bus < 0) {
+		options.i2c_bus_num = panel_lookup_i2c_busses(options.i2c_bus, ATFP_MAX_PANELS);
+		if (options.i2c_bus_num <= 0) {
 			fprintf(stderr, "Could not detect front panel I2C bus \n");
 			exit(1);
 		}
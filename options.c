@@ -20,6 +20,10 @@
 #include "options.h"
 #include "common.h"
 #include "registers.h"
+#include "window.h"
+#include "cpu-freq.h"
+#include "core-map.h"
+#include "filter.h"
 #include "auto_generated.h"
 
 
@@ -51,6 +55,176 @@ static bool loglevel_conv_string_to_int(const char *s_loglevel, int *i_loglevel)
 	return false;
 }
 
+/*
+ * Parse a comma-separated list of up to 'max' integers.
+ * Return:
+ * the number of values parsed
+ */
+static int parse_int_list(const char *s, int *values, int max)
+{
+	char *end;
+	int n = 0;
+
+	while ((s != NULL) && (*s != '\0') && (n < max)) {
+		values[n++] = strtol(s, &end, 0);
+		if (*end != ',')
+			break;
+
+		s = end + 1;
+	}
+
+	return n;
+}
+
+/*
+ * Per-panel i2c delay: the last value given applies to the rest of the panels.
+ */
+static void parse_i2c_delay(Options *opts, const char *s)
+{
+	int delay[ATFP_MAX_PANELS];
+	int i;
+	int n;
+
+	n = parse_int_list(s, delay, ATFP_MAX_PANELS);
+	for (i = 0; (n > 0) && (i < ATFP_MAX_PANELS); ++i)
+		opts->i2c_delay[i] = delay[(i < n) ? i : (n - 1)];
+}
+
+static int conv_int(const char *s, int *value)
+{
+	char *end;
+
+	*value = strtol(s, &end, 0);
+	return (end == s) ? -EINVAL : 0;
+}
+
+/* an interval: 0 would make the scheduler spin */
+static int conv_positive(const char *s, int *value)
+{
+	if (conv_int(s, value) || (*value <= 0))
+		return -EINVAL;
+
+	return 0;
+}
+
+/* a jitter, or a sample interval (0: off) */
+static int conv_non_negative(const char *s, int *value)
+{
+	if (conv_int(s, value) || (*value < 0))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int conv_aggregate(const char *s, int *value)
+{
+	if (!strncmp("max", s, 3))
+		*value = ATFP_AGGREGATE_MAX;
+	else if (!strncmp("mean", s, 4))
+		*value = ATFP_AGGREGATE_MEAN;
+	else if (!strncmp("p95", s, 3))
+		*value = ATFP_AGGREGATE_P95;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int conv_filter(const char *s, int *value)
+{
+	if (!strncmp("none", s, 4))
+		*value = FILTER_NONE;
+	else if (!strncmp("ema", s, 3))
+		*value = FILTER_EMA;
+	else if (!strncmp("median", s, 6))
+		*value = FILTER_MEDIAN;
+	else if (!strncmp("rate", s, 4))
+		*value = FILTER_RATE;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Parse a comma-separated list of FUNC:VALUE pairs, e.g. HDDTR:60000,CPUTR:1000
+ * into 'values' indexed by FP request, converting each VALUE by 'conv'.
+ * 'set' (optional) flags the values parsed.
+ * Return:
+ * 0 or -EINVAL if FUNC is not a known request, or VALUE could not be converted
+ */
+static int parse_request_list(char *s, int *values, bool *set, int (*conv)(const char *, int *))
+{
+	const char *names[] = ATFP_REQUEST_NAMES;
+	char *ptr;
+	char *value;
+	int i;
+
+	for (ptr = strtok(s, ","); ptr != NULL; ptr = strtok(NULL, ",")) {
+		while (isspace(*ptr))
+			++ptr;
+
+		value = strchr(ptr, ':');
+		if (value == NULL)
+			return -EINVAL;
+
+		for (i = 0; i < ATFP_NUM_REQUESTS; ++i) {
+			if (!strncmp(names[i], ptr, strlen(names[i])))
+				break;
+		}
+		if (i == ATFP_NUM_REQUESTS)
+			return -EINVAL;
+
+		if (conv(value + 1, &values[i]))
+			return -EINVAL;
+		if (set != NULL)
+			set[i] = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse FUNC,abs=N,rel=N,hyst=N,hold=T
+ * Keys not specified keep their current value.
+ */
+static int parse_publish_policy(Options *opts, char *s)
+{
+	const char *names[] = ATFP_REQUEST_NAMES;
+	PublishPolicy *policy = NULL;
+	char *ptr;
+	int i;
+	int k;
+
+	ptr = strtok(s, ",");
+	for (i = 0; (ptr != NULL) && (i < ATFP_NUM_REQUESTS); ++i) {
+		if (!strncmp(names[i], ptr, strlen(names[i]))) {
+			policy = &opts->publish[i];
+			break;
+		}
+	}
+	if (policy == NULL)
+		return -EINVAL;
+
+	while ((ptr = strtok(NULL, ",")) != NULL) {
+		while (isspace(*ptr))
+			++ptr;
+
+		if (starts_with("abs=", ptr, k))
+			policy->abs = strtol(&ptr[k], NULL, 0);
+		else if (starts_with("rel=", ptr, k))
+			policy->rel = strtol(&ptr[k], NULL, 0);
+		else if (starts_with("hyst=", ptr, k))
+			policy->hyst = strtol(&ptr[k], NULL, 0);
+		else if (starts_with("hold=", ptr, k))
+			policy->hold = strtol(&ptr[k], NULL, 0);
+		else
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int options_parse_cmdline(Options *opts, int argc, char *argv[])
 {
 	const struct option long_options[] = {
@@ -62,6 +236,7 @@ static int options_parse_cmdline(Options *opts, int argc, char *argv[])
 		{"poll-cycle",		required_argument,	0,	'p'},
 		{"loglevel",      	required_argument,	0,	'l'},
 		{"configfile",          required_argument,	0,	'f'},
+		{"i2c-trace",		required_argument,	0,	't'},
 		{0,			0,			0,	0}
 	};
 
@@ -91,11 +266,11 @@ static int options_parse_cmdline(Options *opts, int argc, char *argv[])
 			opts->info = true;
 			break;
 		case 'b':
-			opts->i2c_bus = strtol(optarg, NULL, 0);
+			opts->i2c_bus_num = parse_int_list(optarg, opts->i2c_bus, ATFP_MAX_PANELS);
 			opts->i2c_bus_set = true;
 			break;
 		case 'd':
-			opts->i2c_delay = strtol(optarg, NULL, 0);
+			parse_i2c_delay(opts, optarg);
 			opts->i2c_delay_set = true;
 			break;
 		case 'p':
@@ -108,6 +283,9 @@ static int options_parse_cmdline(Options *opts, int argc, char *argv[])
 		case 'f':
 			strncpy(opts->configfile, optarg, sizeof(opts->configfile));
 			break;
+		case 't':
+			strncpy(opts->i2c_trace_file, optarg, sizeof(opts->i2c_trace_file) - 1);
+			break;
 		case 'v':
 			opts->version = true;
 			break;
@@ -162,13 +340,13 @@ static int options_parse_configfile(Options *opts, const char *filename)
 		}
 		else if (starts_with("i2c-bus=", line, k)) {
 			if (!opts->i2c_bus_set) {
-				opts->i2c_bus = strtol(&line[k], NULL, 0);
+				opts->i2c_bus_num = parse_int_list(&line[k], opts->i2c_bus, ATFP_MAX_PANELS);
 				opts->i2c_bus_set = true;
 			}
 		}
 		else if (starts_with("i2c-delay=", line, k)) {
 			if (!opts->i2c_delay_set) {
-				opts->i2c_delay = strtol(&line[k], NULL, 0);
+				parse_i2c_delay(opts, &line[k]);
 				opts->i2c_delay_set = true;
 			}
 		}
@@ -183,6 +361,80 @@ static int options_parse_configfile(Options *opts, const char *filename)
 				opts->loglevel_set = loglevel_conv_string_to_int(&line[k], &opts->loglevel);
 			}
 		}
+		else if (starts_with("i2c-trace=", line, k)) {
+			if (opts->i2c_trace_file[0] == '\0') {
+				strncpy(opts->i2c_trace_file, &line[k], sizeof(opts->i2c_trace_file) - 1);
+				strtok(opts->i2c_trace_file, " \t\n");
+			}
+		}
+		else if (starts_with("poll-interval=", line, k)) {
+			if (parse_request_list(&line[k], opts->poll_interval, opts->poll_interval_set, conv_positive))
+				goto configfile_out_err;
+		}
+		else if (starts_with("poll-jitter=", line, k)) {
+			if (parse_request_list(&line[k], opts->poll_jitter, NULL, conv_non_negative))
+				goto configfile_out_err;
+		}
+		else if (starts_with("sample-interval=", line, k)) {
+			if (parse_request_list(&line[k], opts->sample_interval, NULL, conv_non_negative))
+				goto configfile_out_err;
+		}
+		else if (starts_with("aggregate=", line, k)) {
+			if (parse_request_list(&line[k], opts->aggregate, NULL, conv_aggregate))
+				goto configfile_out_err;
+		}
+		else if (starts_with("filter=", line, k)) {
+			if (parse_request_list(&line[k], opts->filter, NULL, conv_filter))
+				goto configfile_out_err;
+		}
+		else if (starts_with("attr-read=", line, k)) {
+			if (!strncmp(&line[k], "io_uring", 8))
+				opts->attr_read_batch = true;
+			else if (!strncmp(&line[k], "pread", 5))
+				opts->attr_read_batch = false;
+			else
+				goto configfile_out_err;
+		}
+		else if (starts_with("cpufreq-source=", line, k)) {
+			if (!strncmp(&line[k], "auto", 4))
+				opts->cpufreq_source = CPU_FREQ_SOURCE_AUTO;
+			else if (!strncmp(&line[k], "msr", 3))
+				opts->cpufreq_source = CPU_FREQ_SOURCE_MSR;
+			else if (!strncmp(&line[k], "sysfs", 5))
+				opts->cpufreq_source = CPU_FREQ_SOURCE_SYSFS;
+			else if (!strncmp(&line[k], "cpuinfo", 7))
+				opts->cpufreq_source = CPU_FREQ_SOURCE_CPUINFO;
+			else
+				goto configfile_out_err;
+		}
+		else if (starts_with("core-map=", line, k)) {
+			if (!strncmp(&line[k], "group", 5))
+				opts->core_map = CORE_MAP_GROUP;
+			else if (!strncmp(&line[k], "socket", 6))
+				opts->core_map = CORE_MAP_SOCKET;
+			else if (!strncmp(&line[k], "hottest", 7))
+				opts->core_map = CORE_MAP_HOTTEST;
+			else
+				goto configfile_out_err;
+		}
+		else if (starts_with("sensor-ttl=", line, k)) {
+			opts->sensor_ttl = strtol(&line[k], NULL, 0);
+		}
+		else if (starts_with("smart-ttl=", line, k)) {
+			opts->smart_ttl = strtol(&line[k], NULL, 0);
+		}
+		else if (starts_with("ambient-sensor=", line, k)) {
+			strncpy(opts->ambient_sensor, &line[k], sizeof(opts->ambient_sensor) - 1);
+			strtok(opts->ambient_sensor, " \t\n");
+		}
+		else if (starts_with("gpu-sensor=", line, k)) {
+			strncpy(opts->gpu_sensor, &line[k], sizeof(opts->gpu_sensor) - 1);
+			strtok(opts->gpu_sensor, " \t\n");
+		}
+		else if (starts_with("publish=", line, k)) {
+			if (parse_publish_policy(opts, &line[k]))
+				goto configfile_out_err;
+		}
 		else if (starts_with("disable=", line, k)) {
 			char *ptr = strtok(&line[k], ",");
 			while (ptr != NULL) {
@@ -222,20 +474,52 @@ static void print_help_message_and_exit(const char *name)
 	fprintf(stderr, "Provide hardware-related metrics to the front panel display controller. \n");
 
 	fprintf(stderr, "\nCommand line options: \n");
-	fprintf(stderr, "  --i2c-bus=N        front panel controller I2C bus. By default, FP I2C bus will be discovered automatically. \n");
-	fprintf(stderr, "  --i2c-delay=T      number of micro-seconds to delay prior to I2C-writing front panel. By default, I2C delay is zero. \n");
-	fprintf(stderr, "  --poll-cycle=T     number of seconds to poll for front panel request. \n");
+	fprintf(stderr, "  --i2c-bus=N[,M]    front panel controller I2C bus(es), one per panel. By default, FP I2C busses will be discovered automatically. \n");
+	fprintf(stderr, "  --i2c-delay=T[,U]  number of micro-seconds to delay prior to I2C-writing front panel, one per panel. By default, I2C delay is zero. \n");
+	fprintf(stderr, "  --poll-cycle=T     default number of seconds between polls (see poll-interval below). \n");
 	fprintf(stderr, "  --loglevel=LEVEL   print to system log messages up to LEVEL. LEVEL may be either [notice], info, debug \n");
 	fprintf(stderr, "  --configfile=PATH  path to (optional) configuration file. By default '/etc/airtop-fpsvc.conf' will be used. \n");
+	fprintf(stderr, "  --i2c-trace=PATH   dump the I2C transaction trace to PATH upon SIGUSR1. \n");
 	fprintf(stderr, "  --info             display brief system information relevant for this daemon and exit \n");
 	fprintf(stderr, "  --version          display daemon version and exit \n");
 	fprintf(stderr, "  --help             display this help and exit \n");
 
 	fprintf(stderr, "\nConfiguration file options: \n");
-	fprintf(stderr, "  i2c-bus=N \n");
-	fprintf(stderr, "  i2c-delay=T \n");
+	fprintf(stderr, "  i2c-bus=N[,M[,...]] \n");
+	fprintf(stderr, "  i2c-delay=T[,U[,...]] \n");
 	fprintf(stderr, "  poll-cycle=T \n");
 	fprintf(stderr, "  loglevel=LEVEL \n");
+	fprintf(stderr, "  i2c-trace=PATH \n");
+	fprintf(stderr, "  poll-interval=FUNC:T[,FUNC:T[,...]]  number of milli-seconds between polls of a particular functionality (FUNC below), T > 0. \n");
+	fprintf(stderr, "                               By default, HDDTR is polled every %d mSec, others every poll-cycle. \n", ATFP_HDD_POLL_INTERVAL);
+	fprintf(stderr, "  poll-jitter=FUNC:T[,FUNC:T[,...]]    random delay of up to T milli-seconds added to each poll interval, T >= 0. \n");
+	fprintf(stderr, "                               By default, HDDTR jitter is %d mSec, others have none. \n", ATFP_HDD_POLL_JITTER);
+	fprintf(stderr, "  sample-interval=FUNC:T[,FUNC:T]  sample FUNC every T milli-seconds between polls; the FP gets an aggregate \n");
+	fprintf(stderr, "                               over the last poll interval. Supported for CPUTR and GPUTR. By default, sampling is off. \n");
+	fprintf(stderr, "  aggregate=FUNC:AGG[,FUNC:AGG]    sampled FUNC aggregate: max (default), mean or p95 \n");
+	fprintf(stderr, "  filter=FUNC:FLT[,FUNC:FLT]   filter FUNC readings: none (default), ema: moving average, \n");
+	fprintf(stderr, "                               median: median of the last %d, rate: change limited to %d per reading. \n",
+		FILTER_MEDIAN_WINDOW, FILTER_RATE_STEP);
+	fprintf(stderr, "                               Supported for CPUTR and GPUTR. \n");
+	fprintf(stderr, "  publish=FUNC[,abs=N][,rel=P][,hyst=N][,hold=T]  publish a new FUNC value to the FP only if it differs from \n");
+	fprintf(stderr, "                               the last published one by at least N units or P percent; a change of direction \n");
+	fprintf(stderr, "                               must be deeper by 'hyst' units; a pending change is published after T mSec. \n");
+	fprintf(stderr, "  attr-read=pread|io_uring     read sensor attributes one by one (default), or in a batch per poll through io_uring; \n");
+	fprintf(stderr, "                               io_uring falls back to pread where not available. \n");
+	fprintf(stderr, "  cpufreq-source=SRC           CPUFR source: auto (default: cpufreq sysfs, else /proc/cpuinfo), sysfs, cpuinfo, \n");
+	fprintf(stderr, "                               or msr: average busy frequency over the poll interval from APERF/MPERF \n");
+	fprintf(stderr, "                               (requires the msr driver; falls back to auto). \n");
+	fprintf(stderr, "  core-map=MAP                 how more than %d cores are shown in the FP core slots (CPUTR, CPUFR): \n", ATFP_MAX_CPU_CORES);
+	fprintf(stderr, "                               group (default): the maximum of consecutive cores; socket: the maximum per package; \n");
+	fprintf(stderr, "                               hottest: the highest values. \n");
+	fprintf(stderr, "  sensor-ttl=T                 serve sensor readings younger than T mSec from a cache shared by all the \n");
+	fprintf(stderr, "                               consumers (default: %d); 0 reads the hardware every time. \n", ATFP_SENSOR_CACHE_TTL);
+	fprintf(stderr, "  smart-ttl=T                  reuse a disk's S.M.A.R.T. reading for T mSec (default: %d; 0: never). \n", ATFP_SMART_CACHE_TTL);
+	fprintf(stderr, "                               A disk in standby is never read, its last reading is shown instead. \n");
+	fprintf(stderr, "  ambient-sensor=CHIP[:LABEL]  hwmon sensors shown as the ambient temperature, along with GPUTR; \n");
+	fprintf(stderr, "                               CHIP and LABEL are patterns, e.g. nct6775*:SYSTIN (see --info); the maximum is shown. \n");
+	fprintf(stderr, "  gpu-sensor=CHIP[:LABEL]      hwmon sensors shown as the GPU temperature, e.g. amdgpu:edge, \n");
+	fprintf(stderr, "                               in place of the GPU driver detected. \n");
 	fprintf(stderr, "  disable=FUNC1[,FUNC2[,...]]  disable particular functionality, that may be requested by the FP controller. FUNC may be: \n");
 	fprintf(stderr, "                               HDDTR  HDD temperature \n");
 	fprintf(stderr, "                               CPUFR  CPU frequency \n");
@@ -248,7 +532,8 @@ static void print_help_message_and_exit(const char *name)
 
 	fprintf(stderr, "\nPOSIX signals interface: \n");
 	fprintf(stderr, "  SIGTERM            stop the daemon. \n");
-	fprintf(stderr, "  SIGUSR1            print to the logger brief runtime statistics. \n");
+	fprintf(stderr, "  SIGUSR1            print to the logger brief runtime statistics and I2C latency histograms, \n");
+	fprintf(stderr, "                     dump I2C transaction trace (if configured). \n");
 
 	exit(1);
 }
@@ -259,10 +544,35 @@ static void options_load_defaults(Options *opts)
 
 	/* non-zero default values */
 	opts->poll_cycle = ATFP_MAIN_POLL_CYCLE;
+	opts->poll_jitter[ATFP_OFFS_PENDR0_HDDTR] = ATFP_HDD_POLL_JITTER;
+	opts->publish[ATFP_OFFS_PENDR0_HDDTR] = (PublishPolicy)ATFP_HDDTR_PUBLISH_POLICY;
+	opts->publish[ATFP_OFFS_PENDR0_CPUFR] = (PublishPolicy)ATFP_CPUFR_PUBLISH_POLICY;
+	opts->publish[ATFP_OFFS_PENDR0_CPUTR] = (PublishPolicy)ATFP_CPUTR_PUBLISH_POLICY;
+	opts->publish[ATFP_OFFS_PENDR0_GPUTR] = (PublishPolicy)ATFP_GPUTR_PUBLISH_POLICY;
+	opts->sensor_ttl = ATFP_SENSOR_CACHE_TTL;
+	opts->smart_ttl = ATFP_SMART_CACHE_TTL;
 	opts->loglevel = LOG_NOTICE;
 	strcpy(opts->configfile, ATFP_DAEMON_CONFIGFILE);
 }
 
+/*
+ * Poll intervals not set explicitly are derived from the poll cycle.
+ */
+static void options_set_poll_intervals(Options *opts)
+{
+	int i;
+
+	for (i = 0; i < ATFP_NUM_REQUESTS; ++i) {
+		if (opts->poll_interval_set[i])
+			continue;
+
+		if (i == ATFP_OFFS_PENDR0_HDDTR)
+			opts->poll_interval[i] = ATFP_HDD_POLL_INTERVAL;
+		else
+			opts->poll_interval[i] = opts->poll_cycle * 1000;
+	}
+}
+
 void options_process_or_abort(Options *opts, int argc, char *argv[])
 {
 	int err;
@@ -278,18 +588,36 @@ void options_process_or_abort(Options *opts, int argc, char *argv[])
 	err = options_parse_configfile(opts, opts->configfile);
 	if (err < 0)
 		exit(1);
+
+	options_set_poll_intervals(opts);
 }
 
 /* for testing purposes */
 void show_options(Options *opts)
 {
+	int i;
+
 	printf("help        : %c \n", opts->help ? '+' : '-');
 	printf("info        : %c \n", opts->info ? '+' : '-');
-	printf("i2c-bus     : %d [%c] \n", opts->i2c_bus, opts->i2c_bus_set ? '+' : '-');
-	printf("i2c-delay   : %u [%c] \n", opts->i2c_delay, opts->i2c_delay_set ? '+' : '-');
+	for (i = 0; i < opts->i2c_bus_num; ++i)
+		printf("i2c-bus[%d]  : %d [%c] \n", i, opts->i2c_bus[i], opts->i2c_bus_set ? '+' : '-');
+	for (i = 0; i < ATFP_MAX_PANELS; ++i)
+		printf("i2c-delay[%d]: %u [%c] \n", i, opts->i2c_delay[i], opts->i2c_delay_set ? '+' : '-');
 	printf("poll-cycle  : %d [%c] \n", opts->poll_cycle, opts->poll_cycle_set ? '+' : '-');
 	printf("loglevel    : %d [%c] \n", opts->loglevel, opts->loglevel_set ? '+' : '-');
 	printf("configfile  : %s \n", opts->configfile);
+	printf("i2c-trace   : %s \n", opts->i2c_trace_file);
 	printf("disable     : 0x%016lx \n", opts->disable);
+	printf("attr-read   : %s \n", opts->attr_read_batch ? "io_uring" : "pread");
+	printf("cpufreq-src : %d \n", opts->cpufreq_source);
+	printf("core-map    : %d \n", opts->core_map);
+	printf("sensor-ttl  : %d [mSec] \n", opts->sensor_ttl);
+	printf("smart-ttl   : %d [mSec] \n", opts->smart_ttl);
+	printf("ambient     : %s \n", opts->ambient_sensor);
+	printf("gpu-sensor  : %s \n", opts->gpu_sensor);
+	for (i = 0; i < ATFP_NUM_REQUESTS; ++i)
+		printf("poll[%d]     : %d +%d [mSec] sample: %d [mSec] agg=%d filter=%d publish: abs=%d rel=%d hyst=%d hold=%d \n", i,
+		       opts->poll_interval[i], opts->poll_jitter[i], opts->sample_interval[i], opts->aggregate[i], opts->filter[i],
+		       opts->publish[i].abs, opts->publish[i].rel, opts->publish[i].hyst, opts->publish[i].hold);
 }
 
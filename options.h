@@ -9,23 +9,55 @@
 
 #include <stdbool.h>
 
+#include "common.h"
+
+
+/*
+ * Publication policy of a metric: a new value is published only if
+ * it differs from the last published one by at least 'abs' units,
+ * or by at least 'rel' percent. A change reversing the direction of the
+ * last published change must exceed the threshold by 'hyst' units.
+ * A pending change is published anyway after 'hold' milli-seconds (0: never).
+ */
+typedef struct {
+	int abs;
+	int rel;
+	int hyst;
+	int hold;
+} PublishPolicy;
 
 typedef struct {
 	bool help;
 	bool info;
 	bool version;
-	int i2c_bus;
-	unsigned int i2c_delay;
+	int i2c_bus[ATFP_MAX_PANELS];
+	int i2c_bus_num;
+	unsigned int i2c_delay[ATFP_MAX_PANELS];
 	int poll_cycle;
 	int loglevel;
 	char configfile[128];
+	char i2c_trace_file[128];
 	long disable;
+	int poll_interval[ATFP_NUM_REQUESTS];	/* mSec */
+	int poll_jitter[ATFP_NUM_REQUESTS];	/* mSec */
+	int sample_interval[ATFP_NUM_REQUESTS];	/* mSec; 0: no sampling */
+	int aggregate[ATFP_NUM_REQUESTS];	/* ATFP_AGGREGATE_* */
+	int filter[ATFP_NUM_REQUESTS];		/* FILTER_* */
+	PublishPolicy publish[ATFP_NUM_REQUESTS];
+	bool attr_read_batch;			/* read attribute groups through io_uring */
+	int cpufreq_source;			/* CPU_FREQ_SOURCE_* */
+	int core_map;				/* CORE_MAP_* */
+	int sensor_ttl;				/* mSec; 0: no sensor cache */
+	int smart_ttl;				/* mSec; 0: no SMART cache */
+	char ambient_sensor[64];		/* hwmon CHIP[:LABEL] for AMBT */
+	char gpu_sensor[64];			/* hwmon CHIP[:LABEL] for GPUT */
 
 	/* _private_ */
 	bool i2c_bus_set;
 	bool i2c_delay_set;
 	bool poll_cycle_set;
 	bool loglevel_set;
+	bool poll_interval_set[ATFP_NUM_REQUESTS];
 } Options;
 
 
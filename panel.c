@@ -7,6 +7,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 #include <asm-generic/errno-base.h>
 #include <linux/i2c-dev.h>
 
@@ -17,18 +20,38 @@
 #include "common.h"
 
 
-/* 
- * Panel descriptor. 
- * Panel descriptor is managed as a singleton object. 
+/*
+ * Panel descriptors.
+ * A chassis may carry more than one FP-style controller (or a mirror display),
+ * hence panels are managed as a table of up to ATFP_MAX_PANELS objects.
+ * Each panel owns its i2c descriptor, output pacing, frontend thread
+ * and a shadow of the FP register file.
  */
-typedef struct {
+struct Panel {
 	bool is_initialized;
+	int i2c_bus;
 	int i2c_desc;
 	unsigned int i2c_delay;
-} Panel;
+	ThreadPool *frontend;
+
+	/* last value written to each register; -1 if unknown */
+	short shadow[ATFP_NUM_REGISTERS];
+
+	/* desired register file contents */
+	PanelImage image;
+};
 
-static Panel panel = {0};
+static Panel panels[ATFP_MAX_PANELS];
+static int panels_num = 0;
+
+
+static void panel_invalidate_shadow(Panel *p)
+{
+	int i;
 
+	for (i = 0; i < ATFP_NUM_REGISTERS; ++i)
+		p->shadow[i] = -1;
+}
 
 /*
  * Open i2c-connected device identified by {i2c-bus:addr} tuple.
@@ -62,41 +85,294 @@ i2c_out_err0:
 	return err;
 }
 
+/*
+ * Open a panel and append it to the panel table.
+ */
 int panel_open_i2c(int i2c_bus, int i2c_addr, unsigned int i2c_delay)
 {
 	int i2c_devnum;
+	Panel *p;
+	int i;
 
-	if ( panel.is_initialized ) {
-		sloge("panel i2c device is already open");
-		return -EEXIST;
+	for (i = 0; i < panels_num; ++i) {
+		if (panels[i].i2c_bus == i2c_bus) {
+			sloge("i2c-%d: panel i2c device is already open", i2c_bus);
+			return -EEXIST;
+		}
+	}
+
+	if (panels_num >= ATFP_MAX_PANELS) {
+		sloge("i2c-%d: too many panels, at most %d supported", i2c_bus, ATFP_MAX_PANELS);
+		return -ENOSPC;
 	}
 
 	i2c_devnum = __panel_open_i2c_device(i2c_bus, i2c_addr);
 	if (i2c_devnum < 0)
 		return i2c_devnum;
 
-	panel.is_initialized = true;
-	panel.i2c_desc = i2c_devnum;
-	panel.i2c_delay = i2c_delay;
+	p = &panels[panels_num++];
+	p->is_initialized = true;
+	p->i2c_bus = i2c_bus;
+	p->i2c_desc = i2c_devnum;
+	p->i2c_delay = i2c_delay;
+	p->frontend = NULL;
+	panel_invalidate_shadow(p);
+	panel_image_reset(&p->image);
 	return 0;
 }
 
 void panel_close(void)
 {
-	if ( !panel.is_initialized )
-		return;
+	int i;
 
-	close(panel.i2c_desc);
-	memset(&panel, 0, sizeof(Panel));
+	for (i = 0; i < panels_num; ++i) {
+		if ( !panels[i].is_initialized )
+			continue;
+
+		close(panels[i].i2c_desc);
+		memset(&panels[i], 0, sizeof(Panel));
+	}
+
+	panels_num = 0;
+}
+
+int panel_count(void)
+{
+	return panels_num;
 }
 
-int panel_read_byte(unsigned regno)
+Panel *panel_get(int index)
+{
+	if ((index < 0) || (index >= panels_num))
+		return NULL;
+
+	return &panels[index];
+}
+
+int panel_index(Panel *p)
+{
+	return (int)(p - panels);
+}
+
+/*
+ * Spawn a single-threaded frontend per panel.
+ * The panel itself is the shared context of its frontend tasks.
+ * A slow i2c bus must not stall the backend feeding the frontend:
+ * a frontend task already queued absorbs a new request for the same work.
+ */
+int panel_create_frontends(int queue_size)
+{
+	int i;
+
+	for (i = 0; i < panels_num; ++i) {
+		panels[i].frontend = thread_pool_create(1, queue_size, &panels[i]);
+		if (panels[i].frontend == NULL)
+			return -ENOMEM;
+
+		thread_pool_set_overflow(panels[i].frontend, THREAD_POOL_OVERFLOW_REPLACE);
+	}
+
+	return 0;
+}
+
+void panel_destroy_frontends(void)
+{
+	int i;
+
+	for (i = 0; i < panels_num; ++i) {
+		if (panels[i].frontend == NULL)
+			continue;
+
+		thread_pool_destroy(panels[i].frontend);
+		panels[i].frontend = NULL;
+	}
+}
+
+ThreadPool *panel_frontend(Panel *p)
+{
+	return p->frontend;
+}
+
+
+/*
+ * I2C transaction trace.
+ *
+ * Every SMBus transaction is recorded into a fixed-size ring buffer,
+ * and accounted in per register group latency histograms.
+ * Writers (the panel frontends) never block: a slot is claimed by an atomic
+ * increment of the ring head, and published by storing its sequence number last.
+ * A reader accepts a record only if its sequence number did not change while
+ * the record was being copied.
+ */
+
+#define I2C_TRACE_LEN			1024	/* power of 2 */
+#define I2C_TRACE_GROUPS		16	/* register group: regno[7:4] */
+#define I2C_TRACE_BUCKETS		16	/* latency: log2(usec) */
+
+typedef struct {
+	unsigned long seq;		/* 0: slot is being written */
+	unsigned long long timestamp;	/* nSec, CLOCK_MONOTONIC */
+	unsigned int duration;		/* nSec */
+	int result;
+	unsigned char panel;
+	unsigned char regno;
+	unsigned char value;
+	char direction;			/* 'R' / 'W' */
+} I2CTraceRecord;
+
+typedef struct {
+	unsigned long count;
+	unsigned long errors;
+	unsigned long long total_ns;
+	unsigned int max_ns;
+	unsigned long hist[I2C_TRACE_BUCKETS];
+} I2CTraceGroup;
+
+static I2CTraceRecord i2c_trace[I2C_TRACE_LEN];
+static unsigned long i2c_trace_head = 0;
+static I2CTraceGroup i2c_trace_groups[I2C_TRACE_GROUPS];
+
+static const char *i2c_trace_group_names[I2C_TRACE_GROUPS] = {
+	"SIG/VER", "POST", "CPUT/GPUT", "HDDT/TS", "ADC", "MEM", "HDD_SZ", "CPUF",
+	"FPCTRL/REQ", "DMI/RTC", "0xa0", "0xb0", "0xc0", "0xd0", "0xe0", "0xf0",
+};
+
+static unsigned long long timespec_to_ns(const struct timespec *ts)
+{
+	return (unsigned long long)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void i2c_trace_record(Panel *p, char direction, unsigned regno, int value, int result,
+			     const struct timespec *start, const struct timespec *end)
+{
+	I2CTraceRecord *rec;
+	I2CTraceGroup *grp;
+	unsigned long seq;
+	unsigned long long t0 = timespec_to_ns(start);
+	unsigned int duration = (unsigned int)(timespec_to_ns(end) - t0);
+	unsigned int usec;
+	unsigned int max;
+	int bucket;
+
+	seq = __atomic_add_fetch(&i2c_trace_head, 1, __ATOMIC_RELAXED);
+	rec = &i2c_trace[seq & (I2C_TRACE_LEN - 1)];
+
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->timestamp = t0;
+	rec->duration = duration;
+	rec->result = result;
+	rec->panel = (unsigned char)panel_index(p);
+	rec->regno = (unsigned char)regno;
+	rec->value = (unsigned char)value;
+	rec->direction = direction;
+	__atomic_store_n(&rec->seq, seq, __ATOMIC_RELEASE);
+
+	/* histograms */
+	grp = &i2c_trace_groups[(regno >> 4) & (I2C_TRACE_GROUPS - 1)];
+	for (bucket = 0, usec = duration / 1000; (usec > 0) && (bucket < I2C_TRACE_BUCKETS - 1); usec >>= 1)
+		++bucket;
+
+	__atomic_add_fetch(&grp->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&grp->total_ns, duration, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&grp->hist[bucket], 1, __ATOMIC_RELAXED);
+	if (result < 0)
+		__atomic_add_fetch(&grp->errors, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&grp->max_ns, __ATOMIC_RELAXED);
+	while ((duration > max) &&
+	       !__atomic_compare_exchange_n(&grp->max_ns, &max, duration, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Print per register group latency summary to the logger.
+ */
+void panel_trace_show(void)
+{
+	I2CTraceGroup *grp;
+	char buffer[256];
+	int len;
+	int g, b;
+
+	for (g = 0; g < I2C_TRACE_GROUPS; ++g) {
+		grp = &i2c_trace_groups[g];
+		if (grp->count == 0)
+			continue;
+
+		slogn("i2c %-10s: %lu transactions, %lu errors, avg %llu [uSec], max %u [uSec]",
+		      i2c_trace_group_names[g], grp->count, grp->errors,
+		      grp->total_ns / grp->count / 1000, grp->max_ns / 1000);
+
+		len = 0;
+		buffer[0] = '\0';
+		for (b = 0; b < I2C_TRACE_BUCKETS; ++b) {
+			if (grp->hist[b] == 0)
+				continue;
+			len += snprintf(buffer + len, sizeof(buffer) - len, " <%uus:%lu",
+					1U << b, grp->hist[b]);
+			if (len >= sizeof(buffer))
+				break;
+		}
+		slogn("i2c %-10s:%s", i2c_trace_group_names[g], buffer);
+	}
+}
+
+/*
+ * Dump the trace ring buffer, oldest record first, to 'filename'.
+ * Not async-signal-safe (snprintf, syslog): call from an ordinary thread.
+ */
+int panel_trace_dump(const char *filename)
+{
+	I2CTraceRecord rec;
+	unsigned long head;
+	unsigned long seq;
+	unsigned long i;
+	char line[128];
+	int len;
+	int fd;
+
+	fd = open(filename, (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+	if (fd < 0) {
+		sloge("%s: could not open i2c trace file: %m", filename);
+		return -1;
+	}
+
+	head = __atomic_load_n(&i2c_trace_head, __ATOMIC_ACQUIRE);
+	i = (head > I2C_TRACE_LEN) ? (head - I2C_TRACE_LEN + 1) : 1;
+	for (; i <= head; ++i) {
+		I2CTraceRecord *slot = &i2c_trace[i & (I2C_TRACE_LEN - 1)];
+
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		rec = *slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if ((seq != i) || (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq))
+			continue;
+
+		len = snprintf(line, sizeof(line), "%llu.%06llu panel%u %c reg=%02x val=%02x res=%d dur=%u\n",
+			       rec.timestamp / 1000000000ULL, (rec.timestamp % 1000000000ULL) / 1000,
+			       rec.panel, rec.direction, rec.regno, rec.value, rec.result, rec.duration / 1000);
+		if (write(fd, line, len) < 0)
+			break;
+	}
+
+	close(fd);
+	return 0;
+}
+
+
+int panel_read_byte(Panel *p, unsigned regno)
 {
 	int value;
+	struct timespec start, end;
 
-	value = i2c_smbus_read_byte_data(panel.i2c_desc, regno);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	value = i2c_smbus_read_byte_data(p->i2c_desc, regno);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	i2c_trace_record(p, 'R', regno, value, value, &start, &end);
 	if (value < 0) {
-		sloge("Could not read register %02x: %d", regno, value);
+		sloge("i2c-%d: could not read register %02x: %d", p->i2c_bus, regno, value);
 	}
 	else {
 		stat_inc_i2c_read_count();
@@ -105,35 +381,264 @@ int panel_read_byte(unsigned regno)
 	return value;
 }
 
-int panel_write_byte(unsigned regno, int data)
+int panel_write_byte(Panel *p, unsigned regno, int data)
 {
 	int err;
+	struct timespec start, end;
 
 	/*
 	 * Optional delay [uSec] in order to control output rate.
 	 */
-	if (panel.i2c_delay > 0)
-		usleep(panel.i2c_delay);
+	if (p->i2c_delay > 0)
+		usleep(p->i2c_delay);
 
-	err = i2c_smbus_write_byte_data(panel.i2c_desc, regno, data);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = i2c_smbus_write_byte_data(p->i2c_desc, regno, data);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	i2c_trace_record(p, 'W', regno, data, err, &start, &end);
 	if (err < 0) {
-		sloge("Could not write register %02x: %d", regno, err);
+		sloge("i2c-%d: could not write register %02x: %d", p->i2c_bus, regno, err);
+		p->shadow[regno & 0xFF] = -1;
 	}
 	else {
 		stat_inc_i2c_write_count();
+		p->shadow[regno & 0xFF] = data & 0xFF;
 	}
 
 	return err;
 }
 
+/*
+ * Write a register only if its shadow differs from 'data'.
+ * Meant for data registers: status (mask) registers have to be
+ * written with panel_write_byte() each time.
+ */
+int panel_update_byte(Panel *p, unsigned regno, int data)
+{
+	if (p->shadow[regno & 0xFF] == (data & 0xFF))
+		return 0;
+
+	return panel_write_byte(p, regno, data);
+}
+
+
+/*
+ * Metric encoders, generated from ATFP_METRIC_MAP.
+ */
+
+typedef struct {
+	const char *name;
+	int base;
+	int slots;
+	int encoding;
+	int status_reg;
+	int status_bit;
+} PanelMetric;
+
+#define PANEL_METRIC_ENTRY(metric, base, slots, enc, status_reg, status_bit)	\
+	[ATFP_METRIC_##metric] = {#metric, (base), (slots), ATFP_ENC_##enc, (status_reg), (status_bit)},
+
+static const PanelMetric panel_metrics[ATFP_METRIC_NUM] = {
+	ATFP_METRIC_MAP(PANEL_METRIC_ENTRY)
+};
+
+#undef PANEL_METRIC_ENTRY
+
+/* status register of the metric owning each data register; ATFP_REG_NONE otherwise */
+static short panel_status_of[ATFP_NUM_REGISTERS];
+static bool panel_is_status[ATFP_NUM_REGISTERS];
+static pthread_once_t panel_metrics_once = PTHREAD_ONCE_INIT;
+
+static int metric_width(const PanelMetric *m)
+{
+	return (m->encoding == ATFP_ENC_U8) ? 1 : 2;
+}
+
+static void panel_metrics_init(void)
+{
+	const PanelMetric *m;
+	int metric;
+	int reg;
+	int n;
+
+	for (reg = 0; reg < ATFP_NUM_REGISTERS; ++reg)
+		panel_status_of[reg] = ATFP_REG_NONE;
+
+	for (metric = 0; metric < ATFP_METRIC_NUM; ++metric) {
+		m = &panel_metrics[metric];
+		n = m->slots * metric_width(m);
+		for (reg = m->base; reg < (m->base + n); ++reg)
+			panel_status_of[reg] = m->status_reg;
+
+		if (m->status_reg != ATFP_REG_NONE)
+			panel_is_status[m->status_reg] = true;
+	}
+}
+
+#define image_use(img, r)	((img)->used[(r) >> 3] |= (1 << ((r) & 7)))
+#define image_is_used(img, r)	((img)->used[(r) >> 3] & (1 << ((r) & 7)))
+
+void panel_image_reset(PanelImage *img)
+{
+	memset(img, 0, sizeof(PanelImage));
+}
+
+static void encode_slot(PanelImage *img, const PanelMetric *m, int slot, int value, bool valid)
+{
+	int reg = m->base + (slot * metric_width(m));
+
+	switch (m->encoding) {
+	case ATFP_ENC_U8:
+		if (valid) {
+			img->reg[reg] = value & 0xFF;
+			image_use(img, reg);
+		}
+		break;
+
+	case ATFP_ENC_U16:
+		if (valid) {
+			img->reg[reg] = value & 0xFF;
+			img->reg[reg + 1] = (value >> 8) & 0xFF;
+			image_use(img, reg);
+			image_use(img, reg + 1);
+		}
+		break;
+
+	case ATFP_ENC_U16V:
+		if (valid) {
+			img->reg[reg] = value & 0xFF;
+			img->reg[reg + 1] = 0x80 | ((value >> 8) & 0xFF);
+			image_use(img, reg);
+		}
+		else {
+			img->reg[reg + 1] = 0x00;
+		}
+		image_use(img, reg + 1);
+		break;
+	}
+
+	if (m->status_reg == ATFP_REG_NONE)
+		return;
+
+	if (valid)
+		img->reg[m->status_reg] |= (1 << (m->status_bit + slot));
+	else
+		img->reg[m->status_reg] &= ~(1 << (m->status_bit + slot));
+	image_use(img, m->status_reg);
+}
 
-int panel_lookup_i2c_bus(void)
+/*
+ * Encode a whole metric snapshot into the image.
+ * Slots at or past 'count', or not in 'valid_mask', are marked invalid.
+ */
+int panel_image_encode(PanelImage *img, int metric, int count, const int *values, unsigned int valid_mask)
+{
+	const PanelMetric *m;
+	int slot;
+
+	if ((metric < 0) || (metric >= ATFP_METRIC_NUM))
+		return -EINVAL;
+
+	m = &panel_metrics[metric];
+	if (count > m->slots) {
+		slogw("%s: %d values, only %d slots available", m->name, count, m->slots);
+		count = m->slots;
+	}
+
+	for (slot = 0; slot < m->slots; ++slot) {
+		if ((slot < count) && (valid_mask & (1U << slot)))
+			encode_slot(img, m, slot, values[slot], true);
+		else
+			encode_slot(img, m, slot, 0, false);
+	}
+
+	return 0;
+}
+
+/*
+ * Encode a single slot of a metric into the image.
+ */
+int panel_image_set(PanelImage *img, int metric, int slot, int value)
+{
+	const PanelMetric *m;
+
+	if ((metric < 0) || (metric >= ATFP_METRIC_NUM))
+		return -EINVAL;
+
+	m = &panel_metrics[metric];
+	if ((slot < 0) || (slot >= m->slots)) {
+		slogw("%s: index out of range: %d", m->name, slot);
+		return -EINVAL;
+	}
+
+	encode_slot(img, m, slot, value, true);
+	return 0;
+}
+
+PanelImage *panel_image(Panel *p)
+{
+	return &p->image;
+}
+
+/*
+ * Diff the panel image against the register shadow, and write the difference.
+ * A status register is written whenever it has changed, or any of the data
+ * registers it qualifies has been written.
+ * Registers are written in ascending order, i.e. data registers precede
+ * their status registers, and a LSB precedes its MSB.
+ */
+int panel_flush(Panel *p)
+{
+	PanelImage *img = &p->image;
+	bool status_dirty[ATFP_NUM_REGISTERS] = {false};
+	int reg;
+	int err;
+
+	pthread_once(&panel_metrics_once, panel_metrics_init);
+
+	for (reg = 0; reg < ATFP_NUM_REGISTERS; ++reg) {
+		if ( !image_is_used(img, reg) )
+			continue;
+
+		if ((p->shadow[reg] == img->reg[reg]) &&
+		    !(panel_is_status[reg] && status_dirty[reg]))
+			continue;
+
+		err = panel_write_byte(p, reg, img->reg[reg]);
+		if ( err )
+			return err;
+
+		if (panel_status_of[reg] != ATFP_REG_NONE)
+			status_dirty[panel_status_of[reg]] = true;
+	}
+
+	return 0;
+}
+
+int panel_set_metric(Panel *p, int metric, int slot, int value)
+{
+	int err;
+
+	err = panel_image_set(&p->image, metric, slot, value);
+	if ( err )
+		return err;
+
+	return panel_flush(p);
+}
+
+
+/*
+ * Discover the i2c busses carrying an FP controller.
+ * Return:
+ * the number of busses stored in 'i2c_busses' (up to 'max_busses')
+ */
+int panel_lookup_i2c_busses(int *i2c_busses, int max_busses)
 {
 	struct i2c_adap *adapters;
 	int i, j;
 	int fd;
 	char signature[5];
-	int ret = -1;
+	int ret = 0;
 
 	adapters = gather_i2c_busses();
 	for (i = 0; adapters && adapters[i].name; ++i) {
@@ -151,12 +656,12 @@ int panel_lookup_i2c_bus(void)
 		close(fd);
 
 		if (!strcmp("CLFP", signature)) {
-			ret = adapters[i].nr;
-			goto lookup_out;
+			i2c_busses[ret++] = adapters[i].nr;
+			if (ret >= max_busses)
+				break;
 		}
 	}
 
-lookup_out:
 	free_adapters(adapters);
 	return ret;
 }
@@ -165,11 +670,11 @@ lookup_out:
  * Return a bitmap of pending requests. 
  * In case of error: return 0 - meaning no requests. 
  */
-long panel_get_pending_requests(void)
+long panel_get_pending_requests(Panel *p)
 {
 	int value;
 
-	value = panel_read_byte(ATFP_REG_REQ);
+	value = panel_read_byte(p, ATFP_REG_REQ);
 	if (value < 0)
 		return 0L;
 
@@ -177,94 +682,62 @@ long panel_get_pending_requests(void)
 	if ( !(value & 0x01) )
 		return 0L;
 
-	value = panel_read_byte(ATFP_REG_PENDR0);
+	value = panel_read_byte(p, ATFP_REG_PENDR0);
 	if (value < 0)
 		return 0L;
 
 	return (long)value;
 }
 
-int panel_set_temperature(int cpu_id, int temp)
+int panel_set_temperature(Panel *p, int cpu_id, int temp)
 {
-	int err;
-	int temp_reg = ATFP_REG_CPU0T + cpu_id;
-	int valid_mask = 1 << cpu_id;
-
-	/* assert((cpu_id >= 0) && (cpu_id <= 7)); */
-
-	err = panel_write_byte(temp_reg, temp);
-	if ( !err )
-		err = panel_write_byte(ATFP_REG_CPUTS, valid_mask);
-
-	return err;
+	return panel_set_metric(p, ATFP_METRIC_CPUT, cpu_id, temp);
 }
 
-int panel_set_frequency(int cpu_id, int freq)
+int panel_set_frequency(Panel *p, int cpu_id, int freq)
 {
-	int err;
-	int freq_reg_lsb = ATFP_REG_CPU0F_LSB + (cpu_id * 2);
-	int freq_reg_msb = ATFP_REG_CPU0F_MSB + (cpu_id * 2);
-
-	/* assert((cpu_id >= 0) && (cpu_id <= 7)); */
-
-	err = panel_write_byte(freq_reg_lsb, (freq & 0xFF));
-	if ( !err )
-		err = panel_write_byte(freq_reg_msb, (0x80 | ((freq >> 8) & 0xFF)));
-
-	return err;
+	return panel_set_metric(p, ATFP_METRIC_CPUF, cpu_id, freq);
 }
 
-int panel_set_gpu_temp(int temp)
+int panel_set_gpu_temp(Panel *p, int temp)
 {
-	int err;
-
-	err = panel_write_byte(ATFP_REG_GPUT, temp);
-	if ( !err )
-		err = panel_write_byte(ATFP_REG_SENSORT, ATFP_MASK_SENSORT_GPUS);
+	return panel_set_metric(p, ATFP_METRIC_GPUT, 0, temp);
+}
 
-	return err;
+int panel_set_hdd_temp(Panel *p, int hdd_id, int temp)
+{
+	return panel_set_metric(p, ATFP_METRIC_HDDT, hdd_id, temp);
 }
 
-int panel_set_hdd_temp(int hdd_id, int temp)
+int panel_reset(Panel *p)
 {
 	int err;
-	int temp_reg = ATFP_REG_HDD0T + hdd_id;
-	int valid_mask = 1 << hdd_id;
-
-	if ((hdd_id < 0) || (hdd_id > 7)) {
-		slogw("HDD: index out of range: %d", hdd_id);
-		return -EINVAL;
-	}
 
-	err = panel_write_byte(temp_reg, temp);
-	if ( !err )
-		err = panel_write_byte(ATFP_REG_HDDTS, valid_mask);
+	err = panel_write_byte(p, ATFP_REG_FPCTRL, ATFP_MASK_FPCTRL_RST);
 
+	/* FP register file contents are unknown past reset */
+	panel_invalidate_shadow(p);
+	panel_image_reset(&p->image);
 	return err;
 }
 
-int panel_reset(void)
-{
-	return panel_write_byte(ATFP_REG_FPCTRL, ATFP_MASK_FPCTRL_RST);
-}
-
-int panel_store_daemon_postcode(void)
+int panel_store_daemon_postcode(Panel *p)
 {
 	int err;
 	int postcode_msb;
 	int postcode_lsb;
 
-	err = panel_write_byte(ATFP_REG_POST_CODE_MSB, ATFP_DAEMON_POSTCODE_MSB);
+	err = panel_write_byte(p, ATFP_REG_POST_CODE_MSB, ATFP_DAEMON_POSTCODE_MSB);
 	if ( err )
 		goto postcode_out;
 
-	err = panel_write_byte(ATFP_REG_POST_CODE_LSB, ATFP_DAEMON_POSTCODE_LSB);
+	err = panel_write_byte(p, ATFP_REG_POST_CODE_LSB, ATFP_DAEMON_POSTCODE_LSB);
 	if ( err )
 		goto postcode_out;
 
 	/* selftest: read back */
-	postcode_msb = panel_read_byte(ATFP_REG_POST_CODE_MSB);
-	postcode_lsb = panel_read_byte(ATFP_REG_POST_CODE_LSB);
+	postcode_msb = panel_read_byte(p, ATFP_REG_POST_CODE_MSB);
+	postcode_lsb = panel_read_byte(p, ATFP_REG_POST_CODE_LSB);
 	if ((postcode_msb != ATFP_DAEMON_POSTCODE_MSB) || (postcode_lsb != ATFP_DAEMON_POSTCODE_LSB))
 		err = -EINVAL;
 
@@ -272,3 +745,47 @@ postcode_out:
 	return err;
 }
 
+
+/* unit test */
+int panel_image_test(void)
+{
+	PanelImage img;
+	const int temp[] = {40, 41, 42, 43};
+	const int freq[] = {0x1234, 800};
+	int err = 0;
+
+	pthread_once(&panel_metrics_once, panel_metrics_init);
+	panel_image_reset(&img);
+
+	panel_image_encode(&img, ATFP_METRIC_CPUT, 4, temp, 0x0B);
+	if ((img.reg[ATFP_REG_CPU0T] != 40) || (img.reg[ATFP_REG_CPU3T] != 43) ||
+	    (img.reg[ATFP_REG_CPUTS] != 0x0B) || image_is_used(&img, ATFP_REG_CPU2T)) {
+		err = -1;
+		goto test_out;
+	}
+
+	panel_image_encode(&img, ATFP_METRIC_CPUF, 2, freq, 0x03);
+	if ((img.reg[ATFP_REG_CPU0F_LSB] != 0x34) || (img.reg[ATFP_REG_CPU0F_MSB] != 0x92) ||
+	    (img.reg[ATFP_REG_CPU1F_MSB] != 0x83) || (img.reg[ATFP_REG_CPU2F_MSB] != 0x00) ||
+	    !image_is_used(&img, ATFP_REG_CPU7F_MSB)) {
+		err = -2;
+		goto test_out;
+	}
+
+	/* SENSORT is shared: GPU and ambient bits are maintained independently */
+	panel_image_set(&img, ATFP_METRIC_GPUT, 0, 55);
+	panel_image_set(&img, ATFP_METRIC_AMBT, 0, 30);
+	panel_image_encode(&img, ATFP_METRIC_GPUT, 0, NULL, 0);
+	if (img.reg[ATFP_REG_SENSORT] != ATFP_MASK_SENSORT_AMBS) {
+		err = -3;
+		goto test_out;
+	}
+
+	if (panel_image_set(&img, ATFP_METRIC_HDDT, 8, 30) != -EINVAL) {
+		err = -4;
+		goto test_out;
+	}
+
+test_out:
+	return err;
+}
@@ -7,24 +7,63 @@
 #ifndef _PANEL_H
 #define _PANEL_H
 
+#include "thread-pool.h"
+
 #define I2C_PANEL_INTERFACE_ADDR	0x21
 
 #define I2C_DEV_NAME_LENGTH		32
 
+/* size of the FP register file */
+#define ATFP_NUM_REGISTERS		256
+
+typedef struct Panel Panel;
+
+/*
+ * Panel image: the desired contents of the FP register file.
+ * Metrics are encoded into the image according to ATFP_METRIC_MAP,
+ * and the image is flushed to the FP by writing only the registers
+ * that differ from what the FP is known to hold.
+ */
+typedef struct {
+	unsigned char reg[ATFP_NUM_REGISTERS];
+	/* registers holding a meaningful value */
+	unsigned char used[ATFP_NUM_REGISTERS / 8];
+} PanelImage;
+
 int panel_open_i2c(int i2c_bus, int i2c_addr, unsigned int i2c_delay);
 void panel_close(void);
-int panel_read_byte(unsigned regno);
-int panel_write_byte(unsigned regno, int data);
+int panel_count(void);
+Panel *panel_get(int index);
+int panel_index(Panel *p);
 
-long panel_get_pending_requests(void);
-int panel_set_temperature(int cpu_id, int temp);
-int panel_set_frequency(int cpu_id, int freq);
-int panel_set_gpu_temp(int temp);
-int panel_set_hdd_temp(int hdd_id, int temp);
-int panel_reset(void);
-int panel_store_daemon_postcode(void);
+int panel_create_frontends(int queue_size);
+void panel_destroy_frontends(void);
+ThreadPool *panel_frontend(Panel *p);
 
-int panel_lookup_i2c_bus(void);
+int panel_read_byte(Panel *p, unsigned regno);
+int panel_write_byte(Panel *p, unsigned regno, int data);
+int panel_update_byte(Panel *p, unsigned regno, int data);
 
-#endif	/* _PANEL_H */
+void panel_image_reset(PanelImage *img);
+int panel_image_encode(PanelImage *img, int metric, int count, const int *values, unsigned int valid_mask);
+int panel_image_set(PanelImage *img, int metric, int slot, int value);
+PanelImage *panel_image(Panel *p);
+int panel_flush(Panel *p);
+int panel_set_metric(Panel *p, int metric, int slot, int value);
+
+long panel_get_pending_requests(Panel *p);
+int panel_set_temperature(Panel *p, int cpu_id, int temp);
+int panel_set_frequency(Panel *p, int cpu_id, int freq);
+int panel_set_gpu_temp(Panel *p, int temp);
+int panel_set_hdd_temp(Panel *p, int hdd_id, int temp);
+int panel_reset(Panel *p);
+int panel_store_daemon_postcode(Panel *p);
+
+void panel_trace_show(void);
+int panel_trace_dump(const char *filename);
 
+int panel_lookup_i2c_busses(int *i2c_busses, int max_busses);
+
+int panel_image_test(void);
+
+#endif	/* _PANEL_H */
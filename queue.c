@@ -67,6 +67,18 @@ void queue_push_back(Queue *q, void *elem)
 		q->count++;
 }
 
+/*
+ * Return:
+ * pointer to the element 'index' positions away from the front, NULL if out of range
+ */
+void *queue_peek(Queue *q, int index)
+{
+	if ((index < 0) || (index >= q->count))
+		return NULL;
+
+	return q->buffer + ((q->head + index) % q->maxlen) * q->elemsize;
+}
+
 
 /* unit test */
 int queue_test(void)
@@ -82,6 +94,11 @@ int queue_test(void)
 		queue_push_back(q, &i);
 	}
 
+	if ((*(int *)queue_peek(q, 0) != 5) || (*(int *)queue_peek(q, 4) != 4) || queue_peek(q, 5)) {
+		err = -100;
+		goto test_out;
+	}
+
 	for (i = 0; i < 8; ++i) {
 		queue_pop_front(q, &x);
 		if (x != expected[i]) {
@@ -26,6 +26,7 @@ bool queue_is_empty(Queue *q);
 bool queue_is_full(Queue *q);
 void queue_pop_front(Queue *q, void *elem);
 void queue_push_back(Queue *q, void *elem);
+void *queue_peek(Queue *q, int index);
 
 int queue_test(void);
 
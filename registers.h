@@ -123,5 +123,43 @@
 #define ATFP_MASK_FPCTRL_RSTUSB		0x02
 #define ATFP_MASK_FPCTRL_IWREN		0x80
 
+/*
+ * Metric register map
+ *
+ * X(metric, first data register, number of slots, encoding, status register, first status bit)
+ *
+ * Encodings:
+ * U8   - one register per slot
+ * U16  - LSB, MSB register pair per slot
+ * U16V - LSB, MSB register pair per slot; MSB[7] is the 'valid' flag
+ *
+ * A slot of a metric having a status register is marked valid
+ * by setting bit (first status bit + slot) of that register.
+ */
+#define ATFP_REG_NONE			(-1)
+
+#define ATFP_METRIC_MAP(X)											\
+	X(CPUT,		ATFP_REG_CPU0T,		8,	U8,	ATFP_REG_CPUTS,		0)			\
+	X(GPUT,		ATFP_REG_GPUT,		1,	U8,	ATFP_REG_SENSORT,	ATFP_OFFS_SENSORT_GPUS)	\
+	X(AMBT,		ATFP_REG_AMBT,		1,	U8,	ATFP_REG_SENSORT,	ATFP_OFFS_SENSORT_AMBS)	\
+	X(HDDT,		ATFP_REG_HDD0T,		8,	U8,	ATFP_REG_HDDTS,		0)			\
+	X(ADC,		ATFP_REG_ADC_LSB,	1,	U16,	ATFP_REG_NONE,		0)			\
+	X(MEM,		ATFP_REG_MEM_LSB,	1,	U16,	ATFP_REG_NONE,		0)			\
+	X(HDDSZ,	ATFP_REG_HDD0_SZ_LSB,	8,	U16,	ATFP_REG_NONE,		0)			\
+	X(CPUF,		ATFP_REG_CPU0F_LSB,	8,	U16V,	ATFP_REG_NONE,		0)
+
+enum {
+	ATFP_ENC_U8,
+	ATFP_ENC_U16,
+	ATFP_ENC_U16V,
+};
+
+#define ATFP_METRIC_ENUM(metric, base, slots, enc, status_reg, status_bit)	ATFP_METRIC_##metric,
+enum {
+	ATFP_METRIC_MAP(ATFP_METRIC_ENUM)
+	ATFP_METRIC_NUM
+};
+#undef ATFP_METRIC_ENUM
+
 #endif	/* _REGISTERS_H */
 
@@ -9,22 +9,52 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <fnmatch.h>
 #include <asm-generic/errno-base.h>
 
 #include <sensors/sensors.h>
 
 #include "common.h"
+#include "attr-reader.h"
+#include "filter.h"
+#include "sensors.h"
+#include "stats.h"
 
 #define SENSORS_CONFIG_FILE		NULL
-#define CORETEMP_SUBFEATURE_MAX		8
+
+typedef struct {
+	const sensors_chip_name *chipname;
+	const sensors_subfeature *subfeature;
+	int package;
+	int core;
+} ChipSensor;
+
+struct sensor_list {
+	ChipSensor *sensor;
+	int num;
+	int size;
+	/* the tempN_input attribute of each sensor, same order */
+	AttrGroup *attrs;
+	/* the last reading of all the sensors [degC], see sensors_cache_fresh() */
+	int *cache;
+	/* per sensor, applied to each reading as it is cached */
+	Filter *filter;
+	int cache_err;
+	unsigned long long cache_usec;
+};
 
 struct sensors_info {
 	bool init_done;
 
-	/* coretemp */
-	const sensors_chip_name *coretemp_chipname;
-	int coretemp_subfeature_ids[CORETEMP_SUBFEATURE_MAX];
-	int coretemp_subfeature_num;
+	/* coretemp, k10temp, zenpower */
+	struct sensor_list cores;
+	struct sensor_list packages;
+	/* configured hwmon sources, see sensors_hwmon_add() */
+	struct sensor_list hwmon[SENSORS_HWMON_MAX];
+	int hwmon_num;
+	/* serializes readers of the attributes (CPU, GPU and hwmon sources) */
+	pthread_mutex_t lock;
 
 	/* nouveau */
 	bool nouveau_sensor_detected;
@@ -32,7 +62,45 @@ struct sensors_info {
 	int nouveau_subfeature_id;
 };
 
-static struct sensors_info sensors = {0};
+static struct sensors_info sensors = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned long long cache_ttl_usec = ATFP_SENSOR_CACHE_TTL * 1000ULL;
+
+static int coretemp_filter = FILTER_NONE;
+
+/*
+ * Filter the CPU temperature readings, FILTER_*.
+ * To be called before sensors_coretemp_init().
+ */
+void sensors_set_filter(int kind)
+{
+	coretemp_filter = kind;
+}
+
+/*
+ * Readings younger than 'msec' milli-seconds are served from the cache
+ * (0: always read the hardware).
+ */
+void sensors_set_cache_ttl(int msec)
+{
+	cache_ttl_usec = (msec > 0) ? (msec * 1000ULL) : 0;
+}
+
+/*
+ * Whether a reading cached at 'stamp' (0: never) may still be served.
+ * The caller holds the lock of the cache: a stale entry is refreshed by the
+ * first reader, while the concurrent ones wait and are served from the cache.
+ */
+bool sensors_cache_fresh(unsigned long long stamp)
+{
+	bool fresh;
+
+	fresh = (stamp != 0) && (clock_monotonic_usec() - stamp < cache_ttl_usec);
+	stat_inc_sensor_cache(fresh);
+	return fresh;
+}
 
 /*
  * Show all the available sensors of a particular type.
@@ -79,73 +147,329 @@ sens_out_err_0:
 }
 
 /*
- * Coretemp - CPU core temperature
+ * Sensor lists
+ *
+ * A list of hwmon temperature sensors, read in a single pass over their
+ * attributes, and cached for the TTL (see sensors_cache_fresh()).
  */
 
-int sensors_coretemp_init(void)
+static int sensors_lib_init(void)
 {
-	const sensors_chip_name chipmatch = {
-		.prefix		= "coretemp",
-		.bus.type	= SENSORS_BUS_TYPE_ANY,
-		.bus.nr		= SENSORS_BUS_NR_ANY,
-		.addr		= SENSORS_CHIP_NAME_ADDR_ANY,
-	};
-
 	int err;
-	int chipno;
-	const sensors_chip_name *chipname;
-	int featno;
-	const sensors_feature *feature;
-	char *da_featname;	/* Dynamically Allocated */
-	const sensors_subfeature *subfeature;
+
+	if (sensors.init_done)
+		return 0;
+
+	err = sensors_init(SENSORS_CONFIG_FILE);
+	if ( err ) {
+		sloge("Could not initialize lm-sensors: %d", err);
+		return err;
+	}
+
+	sensors.init_done = true;
+	return 0;
+}
+
+static int sensor_list_add(struct sensor_list *list, const sensors_chip_name *chipname,
+			const sensors_subfeature *subfeature, int package, int core)
+{
+	ChipSensor *s;
+	int size;
+
+	if (list->num == list->size) {
+		size = list->size ? (list->size * 2) : 16;
+		s = (ChipSensor *)realloc(list->sensor, size * sizeof(ChipSensor));
+		if (s == NULL)
+			return -ENOMEM;
+
+		list->sensor = s;
+		list->size = size;
+	}
+
+	s = &list->sensor[list->num++];
+	s->chipname = chipname;
+	s->subfeature = subfeature;
+	s->package = package;
+	s->core = core;
+	return 0;
+}
+
+static int sensor_compare(const void *a, const void *b)
+{
+	const ChipSensor *sa = (const ChipSensor *)a;
+	const ChipSensor *sb = (const ChipSensor *)b;
+
+	if (sa->package != sb->package)
+		return (sa->package < sb->package) ? -1 : 1;
+	return (sa->core < sb->core) ? -1 : (sa->core > sb->core);
+}
+
+/*
+ * Sort by (package, core), drop duplicates, and resolve each sensor to its
+ * hwmon attribute, e.g. .../hwmon1/temp2_input, to be read directly rather
+ * than through libsensors.
+ */
+static void sensor_list_finish(struct sensor_list *list, const char *what, int filter)
+{
+	char path[ATTR_PATH_SIZE];
+	int n = 0;
 	int i;
-	int core_id;
 
-	if ( !sensors.init_done ) {
-		err = sensors_init(SENSORS_CONFIG_FILE);
-		if ( err ) {
-			sloge("Could not initialize lm-sensors: %d", err);
-			return err;
+	qsort(list->sensor, list->num, sizeof(ChipSensor), sensor_compare);
+
+	for (i = 0; i < list->num; ++i) {
+		if ((n > 0) && !sensor_compare(&list->sensor[n - 1], &list->sensor[i])) {
+			slogw("%s: package %d, %d: duplicate sensor ignored",
+			      what, list->sensor[i].package, list->sensor[i].core);
+			continue;
 		}
+		list->sensor[n++] = list->sensor[i];
+	}
+	list->num = n;
+
+	list->cache = (int *)calloc(list->num + 1, sizeof(int));
+	list->filter = (Filter *)calloc(list->num + 1, sizeof(Filter));
+	if (list->filter == NULL) {
+		free(list->cache);
+		list->cache = NULL;
+		return;
+	}
+	for (i = 0; i < list->num; ++i)
+		filter_init(&list->filter[i], filter);
+
+	/* a sensor whose attribute could not be resolved is read through libsensors */
+	list->attrs = attr_group_create(list->num);
+	if (list->attrs == NULL)
+		return;
+
+	for (i = 0; i < list->num; ++i) {
+		snprintf(path, sizeof(path), "%s/%s", list->sensor[i].chipname->path,
+			 list->sensor[i].subfeature->name);
+		attr_group_add(list->attrs, path, 16);
+	}
+}
+
+static const sensors_subfeature *sensor_get_input(const sensors_chip_name *chipname,
+						    const sensors_feature *feature)
+{
+	const sensors_subfeature *subfeature;
+
+	subfeature = sensors_get_subfeature(chipname, feature, SENSORS_SUBFEATURE_TEMP_INPUT);
+	if ( !subfeature )
+		slogw("%s: %s: could not get subfeature", chipname->prefix, feature->name);
 
-		sensors.init_done = true;
+	return subfeature;
+}
+
+static int sensor_read_libsensors(const ChipSensor *s, int *temp)
+{
+	int err;
+	double temp0;
+
+	err = sensors_get_value(s->chipname, s->subfeature->number, &temp0);
+	if ( err ) {
+		sloge("%s: package %d: %s: could not get temperature value: %d",
+		      s->chipname->prefix, s->package, s->subfeature->name, err);
+		return err;
 	}
 
-	/* get pre-defined sensor chip */
-	chipno = 0;
-	chipname = sensors_get_detected_chips(&chipmatch, &chipno);
-	if ( !chipname ) {
-		sloge("coretemp: could not detect sensor chip");
+	/* temp0 is _effectively_ int */
+	*temp = (int)temp0;
+	return 0;
+}
+
+/* read all the sensors of 'list' into its cache, in a single pass */
+static int sensor_list_refresh(struct sensor_list *list)
+{
+	AttrGroup *g = list->attrs;
+	long millideg;
+	int temp;
+	int i;
+
+	if (g != NULL)
+		attr_group_read(g);
+
+	for (i = 0; i < list->num; ++i) {
+		if ((g != NULL) && (attr_parse_long(&g->attr[i], &millideg) == 0))
+			temp = (int)(millideg / 1000);
+		else if (sensor_read_libsensors(&list->sensor[i], &temp))
+			return -EIO;
+
+		list->cache[i] = filter_update(&list->filter[i], temp);
+	}
+
+	return 0;
+}
+
+/*
+ * Read up to 'max' sensors of 'list' into 'temp' [degC], from the cache
+ * while fresh, otherwise over the hwmon attributes, falling back to
+ * libsensors per sensor.
+ * 'package' (optional) receives the package of each sensor.
+ */
+static int sensor_list_read(struct sensor_list *list, int *temp, int *package, int max)
+{
+	int err;
+	int n;
+	int i;
+
+	n = list->num;
+	if (n > max)
+		n = max;
+	if ((n == 0) || (list->cache == NULL))
 		return -ENODEV;
+
+	pthread_mutex_lock(&sensors.lock);
+	if ( !sensors_cache_fresh(list->cache_usec) ) {
+		list->cache_err = sensor_list_refresh(list);
+		/* a failure is not cached: the next reader retries */
+		list->cache_usec = list->cache_err ? 0 : clock_monotonic_usec();
 	}
+	err = list->cache_err;
 
-	sensors.coretemp_chipname = chipname;
+	for (i = 0; i < n; ++i) {
+		temp[i] = list->cache[i];
+		if (package != NULL)
+			package[i] = list->sensor[i].package;
+	}
+	pthread_mutex_unlock(&sensors.lock);
 
-	/* gather reference to temperature sensors */
+	return err ? err : n;
+}
+
+/*
+ * Coretemp - CPU core temperature
+ *
+ * Every CPU temperature chip is taken, one per package (socket):
+ * coretemp (Intel) reports "Core N" and "Package id N",
+ * k10temp/zenpower (AMD) report "Tccd N" per core complex, and "Tdie"/"Tctl".
+ * Core sensors are kept densely, sorted by (package, core), as are package sensors.
+ */
+
+static const char *coretemp_chips[] = { "coretemp", "k10temp", "zenpower" };
+#define NUM_CORETEMP_CHIPS	(sizeof(coretemp_chips) / sizeof(coretemp_chips[0]))
+
+/*
+ * Gather the sensors of a single chip.
+ * 'package' is the package assumed, unless the chip reports its own.
+ */
+static int coretemp_scan_chip(const sensors_chip_name *chipname, int package)
+{
+	const sensors_subfeature *subfeature;
+	const sensors_subfeature *pkg_subfeature = NULL;
+	const sensors_subfeature *tctl_subfeature = NULL;
+	const sensors_feature *feature;
+	char *da_featname;	/* Dynamically Allocated */
+	int num_cores = 0;
+	int featno;
+	int core_id;
+	int err;
+	int i;
+
+	/* coretemp: the package id is reported alongside the cores */
 	featno = 0;
-	while ((feature = sensors_get_features(&chipmatch, &featno)) != NULL) {
-		/* filter in temperature */
+	while ((feature = sensors_get_features(chipname, &featno)) != NULL) {
 		if (feature->type != SENSORS_FEATURE_TEMP)
 			continue;
 
 		da_featname = sensors_get_label(chipname, feature);
-		i = sscanf(da_featname, "Core %d", &core_id);
+		i = sscanf(da_featname, "Package id %d", &core_id);
 		free(da_featname);
-		if (i == 0)
+		if ((i == 1) && (core_id >= 0)) {
+			package = core_id;
+			break;
+		}
+	}
+
+	featno = 0;
+	while ((feature = sensors_get_features(chipname, &featno)) != NULL) {
+		/* filter in temperature */
+		if (feature->type != SENSORS_FEATURE_TEMP)
 			continue;
 
-		subfeature = sensors_get_subfeature(&chipmatch, feature, SENSORS_SUBFEATURE_TEMP_INPUT);
-		if ( !subfeature ) {
-			sloge("coretemp: could not get subfeature");
-			err = -ENODEV;
-			goto out_err;
+		da_featname = sensors_get_label(chipname, feature);
+		if ((sscanf(da_featname, "Core %d", &core_id) == 1) ||
+		    (sscanf(da_featname, "Tccd%d", &core_id) == 1)) {
+			free(da_featname);
+			if (core_id < 0)
+				continue;
+
+			subfeature = sensor_get_input(chipname, feature);
+			if ( !subfeature )
+				continue;
+
+			err = sensor_list_add(&sensors.cores, chipname, subfeature, package, core_id);
+			if ( err )
+				return err;
+			++num_cores;
+		}
+		else if (!strncmp(da_featname, "Package id", 10) || !strcmp(da_featname, "Tdie")) {
+			free(da_featname);
+			pkg_subfeature = sensor_get_input(chipname, feature);
+		}
+		else if (!strcmp(da_featname, "Tctl")) {
+			free(da_featname);
+			tctl_subfeature = sensor_get_input(chipname, feature);
+		}
+		else {
+			free(da_featname);
+		}
+	}
+
+	/* Tctl may be offset from the actual temperature: only use it without Tdie */
+	if (pkg_subfeature == NULL)
+		pkg_subfeature = tctl_subfeature;
+	if (pkg_subfeature == NULL)
+		return 0;
+
+	err = sensor_list_add(&sensors.packages, chipname, pkg_subfeature, package, 0);
+	if ( err )
+		return err;
+
+	/* no per-core sensors (e.g. k10temp before Zen 2): the package stands for its cores */
+	if (num_cores == 0)
+		err = sensor_list_add(&sensors.cores, chipname, pkg_subfeature, package, 0);
+
+	return err;
+}
+
+int sensors_coretemp_init(void)
+{
+	int err;
+	int chipno;
+	const sensors_chip_name *chipname;
+	int package;
+	unsigned int i;
+
+	err = sensors_lib_init();
+	if ( err )
+		return err;
+
+	/* chips are taken in the order of discovery, as packages 0, 1, ... */
+	package = 0;
+	chipno = 0;
+	while ((chipname = sensors_get_detected_chips(NULL, &chipno)) != NULL) {
+		for (i = 0; i < NUM_CORETEMP_CHIPS; ++i) {
+			if (!strcmp(chipname->prefix, coretemp_chips[i]))
+				break;
 		}
+		if (i == NUM_CORETEMP_CHIPS)
+			continue;
+
+		err = coretemp_scan_chip(chipname, package++);
+		if ( err )
+			goto out_err;
+	}
 
-		/* assert((core_id >= 0) && (core_id < CORETEMP_SUBFEATURE_MAX)); */
-		sensors.coretemp_subfeature_ids[core_id] = subfeature->number;
-		++sensors.coretemp_subfeature_num;
+	if (sensors.cores.num == 0) {
+		sloge("coretemp: could not detect sensor chip");
+		err = -ENODEV;
+		goto out_err;
 	}
 
+	sensor_list_finish(&sensors.cores, "coretemp", coretemp_filter);
+	sensor_list_finish(&sensors.packages, "coretemp package", coretemp_filter);
+	slogi("coretemp: %d cores, %d packages", sensors.cores.num, sensors.packages.num);
 	return 0;
 
 out_err:
@@ -153,21 +477,53 @@ out_err:
 	return err;
 }
 
+int sensors_coretemp_count(void)
+{
+	return sensors.cores.num;
+}
+
+int sensors_package_count(void)
+{
+	return sensors.packages.num;
+}
+
+/*
+ * Read up to 'max' cores into 'temp' [degC], ordered by (package, core).
+ * 'package' (optional) receives the package of each core, see core_map().
+ * Return:
+ * the number of cores read, or -errno
+ */
+int sensors_coretemp_read_all(int *temp, int *package, int max)
+{
+	return sensor_list_read(&sensors.cores, temp, package, max);
+}
+
+/*
+ * Read up to 'max' package sensors into 'temp' [degC], ordered by package.
+ * Return:
+ * the number of packages read, or -errno
+ */
+int sensors_package_read_all(int *temp, int max)
+{
+	return sensor_list_read(&sensors.packages, temp, NULL, max);
+}
+
+/*
+ * Read core '*core_id' (0 .. sensors_coretemp_count() - 1), and advance
+ * '*core_id' to the next core, or -1 after the last one.
+ */
 int sensors_coretemp_read(int *core_id, int *temp)
 {
 	int err;
-	double temp0;
 
-	/* assert((*core_id >= 0) && (*core_id < sensors.coretemp_subfeature_num)); */
-	err = sensors_get_value(sensors.coretemp_chipname, sensors.coretemp_subfeature_ids[ *core_id ], &temp0);
-	if ( err ) {
-		sloge("coretemp: Core %d: could not get temperature value: %d", *core_id, err);
+	if ((*core_id < 0) || (*core_id >= sensors.cores.num))
+		return -ENODEV;
+
+	err = sensor_read_libsensors(&sensors.cores.sensor[*core_id], temp);
+	if ( err )
 		goto out_err;
-	}
 
-	/* temp0 is _effectively_ int */
-	*temp = (int)temp0;
-	if (*core_id < (sensors.coretemp_subfeature_num - 1)) {
+	if (*core_id < (sensors.cores.num - 1)) {
 		++(*core_id);
 	}
 	else {
@@ -179,6 +535,115 @@ out_err:
 }
 
 
+/*
+ * Hwmon sources - ambient and other auxiliary temperatures
+ *
+ * A source is configured as CHIP[:LABEL], both shell patterns, e.g.
+ * "nct6775*:SYSTIN" or "acpitz": the temperature sensors matching
+ * are resolved once, and the source reads their maximum.
+ */
+
+/*
+ * Return:
+ * the source handle for sensors_hwmon_read(), or -errno
+ */
+int sensors_hwmon_add(const char *spec)
+{
+	struct sensor_list *list;
+	char chip[64];
+	const char *label;
+	const char *colon;
+	int chipno;
+	const sensors_chip_name *chipname;
+	int featno;
+	const sensors_feature *feature;
+	const sensors_subfeature *subfeature;
+	char *da_featname;	/* Dynamically Allocated */
+	bool match;
+	int err;
+
+	if (sensors.hwmon_num == SENSORS_HWMON_MAX)
+		return -ENOSPC;
+
+	colon = strchr(spec, ':');
+	label = (colon != NULL) ? (colon + 1) : "*";
+	snprintf(chip, sizeof(chip), "%.*s", (colon != NULL) ? (int)(colon - spec) : (int)strlen(spec), spec);
+
+	err = sensors_lib_init();
+	if ( err )
+		return err;
+
+	list = &sensors.hwmon[sensors.hwmon_num];
+	chipno = 0;
+	while ((chipname = sensors_get_detected_chips(NULL, &chipno)) != NULL) {
+		if (fnmatch(chip, chipname->prefix, 0))
+			continue;
+
+		featno = 0;
+		while ((feature = sensors_get_features(chipname, &featno)) != NULL) {
+			if (feature->type != SENSORS_FEATURE_TEMP)
+				continue;
+
+			da_featname = sensors_get_label(chipname, feature);
+			match = !fnmatch(label, da_featname, 0);
+			free(da_featname);
+			if ( !match )
+				continue;
+
+			subfeature = sensor_get_input(chipname, feature);
+			if ( !subfeature )
+				continue;
+
+			/* kept in the order of discovery */
+			err = sensor_list_add(list, chipname, subfeature, 0, list->num);
+			if ( err ) {
+				list->num = 0;
+				return err;
+			}
+		}
+	}
+
+	if (list->num == 0) {
+		slogw("%s: no matching temperature sensor", spec);
+		return -ENODEV;
+	}
+
+	sensor_list_finish(list, spec, FILTER_NONE);
+	slogi("%s: %d sensors", spec, list->num);
+	return sensors.hwmon_num++;
+}
+
+static int hwmon_read_max(struct sensor_list *list, int *temp)
+{
+	int values[list->num + 1];
+	int n;
+	int i;
+
+	n = sensor_list_read(list, values, NULL, list->num);
+	if (n < 0)
+		return n;
+
+	*temp = values[0];
+	for (i = 1; i < n; ++i) {
+		if (values[i] > *temp)
+			*temp = values[i];
+	}
+
+	return 0;
+}
+
+/*
+ * Read the maximum of the sensors of source 'handle' [degC].
+ */
+int sensors_hwmon_read(int handle, int *temp)
+{
+	if ((handle < 0) || (handle >= sensors.hwmon_num))
+		return -ENODEV;
+
+	return hwmon_read_max(&sensors.hwmon[handle], temp);
+}
+
+
 /*
  * Nouveau - NVIDIA GPU temperature under Nouveau open source driver
  */
@@ -7,9 +7,25 @@
 #ifndef _SENSORS_H
 #define _SENSORS_H
 
+#include <stdbool.h>
+
+void sensors_set_cache_ttl(int msec);
+bool sensors_cache_fresh(unsigned long long stamp);
+void sensors_set_filter(int kind);
+
 int sensors_show(int sens_feature_type);
 int sensors_coretemp_init(void);
+int sensors_coretemp_count(void);
 int sensors_coretemp_read(int *core_id, int *temp);
+int sensors_coretemp_read_all(int *temp, int *package, int max);
+int sensors_package_count(void);
+int sensors_package_read_all(int *temp, int max);
+
+/* hwmon sources configured */
+#define SENSORS_HWMON_MAX		4
+
+int sensors_hwmon_add(const char *spec);
+int sensors_hwmon_read(int handle, int *temp);
 
 int sensors_nouveau_init(void);
 int sensors_nouveau_read(int *temp);
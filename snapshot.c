@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+/*
+ * Metric snapshot published through a sequence lock.
+ *
+ * A snapshot has a single writer (the backend task acquiring the metric),
+ * and any number of readers (the panel frontends). Readers never block the
+ * writer, and use the snapshot in place: a reader that raced with an update
+ * detects it by a sequence number change, and simply reads again.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "snapshot.h"
+
+
+/*
+ * Writer: replace snapshot contents.
+ */
+void snapshot_publish(MetricSnapshot *s, int count, const int *values, unsigned int valid_mask)
+{
+	unsigned int seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+
+	if (count > ATFP_SNAPSHOT_SLOTS)
+		count = ATFP_SNAPSHOT_SLOTS;
+
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s->count = count;
+	s->valid_mask = valid_mask;
+	memcpy(s->value, values, count * sizeof(int));
+
+	__atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reader: return the sequence number of a complete snapshot.
+ */
+unsigned int snapshot_read_begin(MetricSnapshot *s)
+{
+	unsigned int seq;
+
+	while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+/*
+ * Reader: test whether the snapshot has changed since snapshot_read_begin().
+ */
+bool snapshot_read_retry(MetricSnapshot *s, unsigned int seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq);
+}
+
+
+/* unit test */
+static void *snapshot_test_writer(void *arg)
+{
+	MetricSnapshot *s = (MetricSnapshot *)arg;
+	int values[ATFP_SNAPSHOT_SLOTS];
+	int i, j;
+
+	for (i = 1; i <= 200000; ++i) {
+		for (j = 0; j < ATFP_SNAPSHOT_SLOTS; ++j)
+			values[j] = i;
+		snapshot_publish(s, ATFP_SNAPSHOT_SLOTS, values, i);
+	}
+
+	return NULL;
+}
+
+int snapshot_test(void)
+{
+	MetricSnapshot s = {0};
+	pthread_t writer;
+	unsigned int seq;
+	int value;
+	bool torn;
+	int last = 0;
+	int i;
+	int err = 0;
+
+	pthread_create(&writer, NULL, snapshot_test_writer, &s);
+
+	while (last < 200000) {
+		do {
+			seq = snapshot_read_begin(&s);
+			value = s.value[0];
+			torn = (s.valid_mask != value);
+			for (i = 1; i < ATFP_SNAPSHOT_SLOTS; ++i)
+				torn |= (s.value[i] != value);
+		} while (snapshot_read_retry(&s, seq));
+
+		/* a complete snapshot must be consistent and never go back in time */
+		if (torn || (value < last)) {
+			err = -1;
+			break;
+		}
+		last = value;
+	}
+
+	pthread_join(writer, NULL);
+	return err;
+}
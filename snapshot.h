@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+/*
+ * Metric snapshot published through a sequence lock.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdbool.h>
+
+
+#define ATFP_SNAPSHOT_SLOTS		8
+
+typedef struct {
+	/* odd while an update is in progress */
+	unsigned int seq;
+	int count;
+	unsigned int valid_mask;
+	int value[ATFP_SNAPSHOT_SLOTS];
+} MetricSnapshot;
+
+
+void snapshot_publish(MetricSnapshot *s, int count, const int *values, unsigned int valid_mask);
+unsigned int snapshot_read_begin(MetricSnapshot *s);
+bool snapshot_read_retry(MetricSnapshot *s, unsigned int seq);
+
+int snapshot_test(void);
+
+#endif	/* _SNAPSHOT_H */
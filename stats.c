@@ -10,11 +10,28 @@
 #include "common.h"
 
 
+typedef struct {
+	unsigned long runs;
+	unsigned long total_usec;
+	unsigned long max_usec;
+	unsigned long published;
+	unsigned long suppressed;
+	unsigned long skipped;		/* still in processing when due */
+	unsigned long reclaimed;	/* stuck past the timeout */
+	unsigned long stale;		/* completed after being reclaimed */
+} SourceTime;
+
 typedef struct {
 	unsigned int show_counter;
 	unsigned long i2c_trans_write;
 	unsigned long i2c_trans_read;
 	unsigned long watchdog_list_length;
+	unsigned long sensor_cache_hits;
+	unsigned long sensor_cache_refreshes;
+	unsigned long smart_reads;
+	unsigned long smart_cached;
+	unsigned long smart_standby;	/* wakeups avoided */
+	SourceTime source[ATFP_NUM_REQUESTS];
 } Statistics;
 
 
@@ -28,11 +45,30 @@ void stat_reset(void)
 
 void stat_show(void)
 {
+	const char *names[] = ATFP_REQUEST_NAMES;
+	SourceTime *st;
+	int i;
+
 	atfp_stat.show_counter++;
 	slogn("ATFP Statistics: %d", atfp_stat.show_counter);
 	slogn("i2c write transactions: %ld", atfp_stat.i2c_trans_write);
 	slogn("i2c read transactions:  %ld", atfp_stat.i2c_trans_read);
 	slogn("watchdog list length: %ld", atfp_stat.watchdog_list_length);
+	slogn("sensor cache: %lu hits, %lu refreshes", atfp_stat.sensor_cache_hits, atfp_stat.sensor_cache_refreshes);
+	slogn("SMART: %lu reads, %lu cached, %lu disks in standby not woken",
+	      atfp_stat.smart_reads, atfp_stat.smart_cached, atfp_stat.smart_standby);
+
+	for (i = 0; i < ATFP_NUM_REQUESTS; ++i) {
+		st = &atfp_stat.source[i];
+		if (st->runs == 0)
+			continue;
+
+		slogn("%s: %lu runs, avg %lu [uSec], max %lu [uSec], total %lu [mSec]",
+		      names[i], st->runs, st->total_usec / st->runs, st->max_usec, st->total_usec / 1000);
+		slogn("%s: %lu updates published, %lu suppressed", names[i], st->published, st->suppressed);
+		slogn("%s: %lu polls skipped, %lu requests reclaimed, %lu stale completions",
+		      names[i], st->skipped, st->reclaimed, st->stale);
+	}
 }
 
 void stat_inc_i2c_write_count(void)
@@ -50,3 +86,84 @@ void stat_inc_watchdog_list_length(void)
 	atfp_stat.watchdog_list_length++;
 }
 
+
+/*
+ * Account time spent acquiring a particular metric source (ATFP_OFFS_PENDR0_*).
+ * Each source is acquired by a single backend task at a time.
+ */
+void stat_add_source_time(int source, unsigned long usec)
+{
+	SourceTime *st;
+
+	if ((source < 0) || (source >= ATFP_NUM_REQUESTS))
+		return;
+
+	st = &atfp_stat.source[source];
+	st->runs++;
+	st->total_usec += usec;
+	if (usec > st->max_usec)
+		st->max_usec = usec;
+}
+
+/*
+ * Account per-slot updates published and suppressed by the publication policy.
+ */
+void stat_add_publish(int source, unsigned int published, unsigned int suppressed)
+{
+	if ((source < 0) || (source >= ATFP_NUM_REQUESTS))
+		return;
+
+	atfp_stat.source[source].published += published;
+	atfp_stat.source[source].suppressed += suppressed;
+}
+
+/*
+ * Account requests that did not complete in time (ATFP_OFFS_PENDR0_*).
+ * These are rare events updated by different threads, hence atomically.
+ */
+void stat_inc_skipped(int source)
+{
+	if ((source >= 0) && (source < ATFP_NUM_REQUESTS))
+		__sync_fetch_and_add(&atfp_stat.source[source].skipped, 1);
+}
+
+void stat_inc_reclaimed(int source)
+{
+	if ((source >= 0) && (source < ATFP_NUM_REQUESTS))
+		__sync_fetch_and_add(&atfp_stat.source[source].reclaimed, 1);
+}
+
+void stat_inc_stale(int source)
+{
+	if ((source >= 0) && (source < ATFP_NUM_REQUESTS))
+		__sync_fetch_and_add(&atfp_stat.source[source].stale, 1);
+}
+
+/*
+ * Account sensor readings served from the cache, and those that hit the hardware.
+ */
+void stat_inc_sensor_cache(bool hit)
+{
+	if (hit)
+		__sync_fetch_and_add(&atfp_stat.sensor_cache_hits, 1);
+	else
+		__sync_fetch_and_add(&atfp_stat.sensor_cache_refreshes, 1);
+}
+
+/*
+ * Account SMART reads, and those avoided (HDD polls run one at a time).
+ */
+void stat_inc_smart_read(void)
+{
+	atfp_stat.smart_reads++;
+}
+
+void stat_inc_smart_cached(void)
+{
+	atfp_stat.smart_cached++;
+}
+
+void stat_inc_smart_standby(void)
+{
+	atfp_stat.smart_standby++;
+}
@@ -7,11 +7,22 @@
 #ifndef _STATS_H
 #define _STATS_H
 
+#include <stdbool.h>
+
 void stat_reset(void);
 void stat_show(void);
 void stat_inc_i2c_write_count(void);
 void stat_inc_i2c_read_count(void);
 void stat_inc_watchdog_list_length(void);
+void stat_add_source_time(int source, unsigned long usec);
+void stat_add_publish(int source, unsigned int published, unsigned int suppressed);
+void stat_inc_skipped(int source);
+void stat_inc_reclaimed(int source);
+void stat_inc_stale(int source);
+void stat_inc_sensor_cache(bool hit);
+void stat_inc_smart_read(void);
+void stat_inc_smart_cached(void);
+void stat_inc_smart_standby(void);
 
 #endif	/* _STATS_H */
 
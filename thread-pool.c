@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <asm-generic/errno-base.h>
 
 #include "thread-pool.h"
 #include "watchdog.h"
@@ -110,6 +111,8 @@ ThreadPool *thread_pool_create(int thread_count, int queue_size, void *shared_co
 	p->work_queue = queue_create(sizeof(ThreadPoolRequest), queue_size);
 
 	p->shared_context = shared_context;
+	p->overflow = THREAD_POOL_OVERFLOW_BLOCK;
+	memset(&p->stats, 0, sizeof(ThreadPoolStats));
 
 	/*
 	 * As the threads are born live,
@@ -161,8 +164,64 @@ void thread_pool_destroy(ThreadPool *p)
 	thread_pool_watchdog_cleanup();
 }
 
-void thread_pool_add_request(ThreadPool *p, ThreadPoolWork func, void *context)
+void thread_pool_set_overflow(ThreadPool *p, ThreadPoolOverflow overflow)
 {
+	pthread_mutex_lock(&p->lock);
+	p->overflow = overflow;
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Handle a full work queue according to 'overflow'; called with the lock held.
+ * Return:
+ * 0 - there is a free slot now,
+ * 1 - 'req' has been merged into a queued request,
+ * -EAGAIN - 'req' is rejected
+ */
+static int thread_pool_overflow(ThreadPool *p, ThreadPoolRequest *req, ThreadPoolOverflow overflow)
+{
+	ThreadPoolRequest *queued;
+	ThreadPoolRequest old;
+	int i;
+
+	switch (overflow) {
+	case THREAD_POOL_OVERFLOW_BLOCK:
+		p->stats.blocked++;
+		while (queue_is_full(p->work_queue)) {
+			pthread_cond_wait(&p->queue_not_full, &p->lock);
+		}
+		return 0;
+
+	case THREAD_POOL_OVERFLOW_DROP_OLDEST:
+		queue_pop_front(p->work_queue, &old);
+		if (old.deadline != NULL)
+			watchdog_clear_deadline(thread_pool_watchdog, old.deadline);
+		p->stats.dropped++;
+		return 0;
+
+	case THREAD_POOL_OVERFLOW_REPLACE:
+		for (i = 0; (queued = queue_peek(p->work_queue, i)) != NULL; ++i) {
+			if (queued->func != req->func)
+				continue;
+
+			/* the queued request keeps its (earlier) deadline */
+			queued->context = req->context;
+			p->stats.replaced++;
+			return 1;
+		}
+		/* fall through */
+
+	case THREAD_POOL_OVERFLOW_FAIL:
+	default:
+		p->stats.rejected++;
+		return -EAGAIN;
+	}
+}
+
+static int thread_pool_submit(ThreadPool *p, ThreadPoolWork func, void *context, bool may_block)
+{
+	ThreadPoolOverflow overflow;
+	int ret = 0;
 	ThreadPoolRequest req = {
 		.func = func,
 		.context = context,
@@ -171,14 +230,58 @@ void thread_pool_add_request(ThreadPool *p, ThreadPoolWork func, void *context)
 
 	pthread_mutex_lock(&p->lock);
 
-	while (queue_is_full(p->work_queue)) {
-		pthread_cond_wait(&p->queue_not_full, &p->lock);
+	if (queue_is_full(p->work_queue)) {
+		overflow = p->overflow;
+		if ((overflow == THREAD_POOL_OVERFLOW_BLOCK) && !may_block)
+			overflow = THREAD_POOL_OVERFLOW_FAIL;
+
+		ret = thread_pool_overflow(p, &req, overflow);
+	}
+
+	if (ret == 0) {
+		queue_push_back(p->work_queue, &req);
+		p->stats.added++;
+		pthread_cond_signal(&p->queue_not_empty);
 	}
 
-	queue_push_back(p->work_queue, &req);
+	pthread_mutex_unlock(&p->lock);
+
+	/* 'req' has not been queued: nobody is going to meet its deadline */
+	if ((ret != 0) && (req.deadline != NULL))
+		watchdog_clear_deadline(thread_pool_watchdog, req.deadline);
+
+	return (ret < 0) ? ret : 0;
+}
+
+/*
+ * Add a request, handling a full work queue according to the pool overflow policy.
+ * Return:
+ * 0 on success (including a request merged into a queued one), -EAGAIN if rejected
+ */
+int thread_pool_add_request(ThreadPool *p, ThreadPoolWork func, void *context)
+{
+	return thread_pool_submit(p, func, context, true);
+}
+
+/*
+ * Same as thread_pool_add_request(), but never blocks:
+ * a pool with a blocking overflow policy rejects the request instead.
+ */
+int thread_pool_try_add_request(ThreadPool *p, ThreadPoolWork func, void *context)
+{
+	return thread_pool_submit(p, func, context, false);
+}
+
+void thread_pool_show(ThreadPool *p, const char *name)
+{
+	ThreadPoolStats st;
 
-	pthread_cond_signal(&p->queue_not_empty);
+	pthread_mutex_lock(&p->lock);
+	st = p->stats;
 	pthread_mutex_unlock(&p->lock);
+
+	slogn("%s: %lu requests added, %lu blocked, %lu rejected, %lu dropped, %lu replaced",
+	      name, st.added, st.blocked, st.rejected, st.dropped, st.replaced);
 }
 
 
@@ -212,7 +315,19 @@ int thread_pool_test(void)
 		t->ans = t->x - t->y;
 	}
 
+	void func_hold(void *a, void *b)
+	{
+		while (*(volatile int *)a)
+			usleep(100);
+	}
+
+	void func_nop(void *a, void *b)
+	{
+	}
+
 	ThreadPool *tp;
+	ThreadPool *tp_overflow = NULL;
+	volatile int hold = 1;
 	int i;
 	int err = 0;
 
@@ -245,7 +360,39 @@ int thread_pool_test(void)
 		}
 	}
 
+	/* overflow policies: the single runner is held, the queue is full */
+	tp_overflow = thread_pool_create(1, 2, NULL);
+	thread_pool_add_request(tp_overflow, func_hold, (void *)&hold);
+	usleep(10000);
+	thread_pool_add_request(tp_overflow, func_nop, NULL);
+	thread_pool_add_request(tp_overflow, func_minus, NULL);
+
+	if (thread_pool_try_add_request(tp_overflow, func_nop, NULL) != -EAGAIN) {
+		err = -test_length - 1;
+		goto test_out;
+	}
+
+	thread_pool_set_overflow(tp_overflow, THREAD_POOL_OVERFLOW_REPLACE);
+	if ((thread_pool_add_request(tp_overflow, func_nop, (void *)&hold) != 0) ||
+	    (thread_pool_add_request(tp_overflow, func_plus, NULL) != -EAGAIN) ||
+	    (tp_overflow->stats.replaced != 1)) {
+		err = -test_length - 2;
+		goto test_out;
+	}
+
+	/* drops func_nop, then func_minus: the queue is left with 2 x func_nop */
+	thread_pool_set_overflow(tp_overflow, THREAD_POOL_OVERFLOW_DROP_OLDEST);
+	if ((thread_pool_add_request(tp_overflow, func_nop, NULL) != 0) ||
+	    (thread_pool_add_request(tp_overflow, func_nop, NULL) != 0) ||
+	    (tp_overflow->stats.dropped != 2) || (tp_overflow->stats.rejected != 2)) {
+		err = -test_length - 3;
+		goto test_out;
+	}
+
 test_out:
+	hold = 0;
+	if (tp_overflow != NULL)
+		thread_pool_destroy(tp_overflow);
 	thread_pool_destroy(tp);
 	return err;
 }
@@ -13,12 +13,37 @@
 
 typedef void (*ThreadPoolWork)(void *priv_context, void *shared_context);
 
+/*
+ * What adding a request to a full work queue does:
+ * BLOCK        - wait for a free slot (default)
+ * FAIL         - reject the new request
+ * DROP_OLDEST  - drop the request at the front of the queue
+ * REPLACE      - a request for the same work function already queued
+ *                takes the new context; if there is none, reject
+ */
+typedef enum {
+	THREAD_POOL_OVERFLOW_BLOCK,
+	THREAD_POOL_OVERFLOW_FAIL,
+	THREAD_POOL_OVERFLOW_DROP_OLDEST,
+	THREAD_POOL_OVERFLOW_REPLACE,
+} ThreadPoolOverflow;
+
+typedef struct {
+	unsigned long added;
+	unsigned long blocked;
+	unsigned long rejected;
+	unsigned long dropped;
+	unsigned long replaced;
+} ThreadPoolStats;
+
 typedef struct {
 	pthread_mutex_t lock;
 	pthread_cond_t queue_not_empty;
 	pthread_cond_t queue_not_full;
 	Queue *work_queue;
 	void *shared_context;
+	ThreadPoolOverflow overflow;
+	ThreadPoolStats stats;
 	int thread_count;
 	/* 'thread_pool' must be the last */
 	pthread_t thread_pool[0];
@@ -27,7 +52,10 @@ typedef struct {
 ThreadPool *thread_pool_create(int thread_count, int queue_size, void *shared_context);
 void thread_pool_join(ThreadPool *p);
 void thread_pool_destroy(ThreadPool *p);
-void thread_pool_add_request(ThreadPool *p, ThreadPoolWork func, void *context);
+void thread_pool_set_overflow(ThreadPool *p, ThreadPoolOverflow overflow);
+int thread_pool_add_request(ThreadPool *p, ThreadPoolWork func, void *context);
+int thread_pool_try_add_request(ThreadPool *p, ThreadPoolWork func, void *context);
+void thread_pool_show(ThreadPool *p, const char *name);
 
 int thread_pool_test(void);
 
@@ -12,12 +12,14 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <asm-generic/errno-base.h>
 
 #include "common.h"
 #include "nvml-tools.h"
 #include "sensors.h"
+#include "filter.h"
 
 
 int (*GPU_get_temperature)(int *temp);
@@ -193,20 +195,25 @@ static int nvidia_gpu_get_temperature(int *temp)
  */
 static int i915_gpu_get_temperature(int *temp)
 {
-	int core_id;
-	int temp0;
-	int err;
+	int core_temp[sensors_coretemp_count() + 1];
+	int num_sensors;
+	int i;
+
+	/* the package sensor covers the GPU as well: prefer it over the cores */
+	if (sensors_package_read_all(temp, 1) == 1)
+		return 0;
+
+	num_sensors = sensors_coretemp_read_all(core_temp, NULL, sensors_coretemp_count());
+	if (num_sensors < 0)
+		return num_sensors;
 
 	*temp = 0;
-	for (core_id = 0; core_id >= 0;) {
-		err = sensors_coretemp_read(&core_id, &temp0);
-		if ( err )
-			break;
-		if (temp0 > *temp)
-			*temp = temp0;
+	for (i = 0; i < num_sensors; ++i) {
+		if (core_temp[i] > *temp)
+			*temp = core_temp[i];
 	}
 
-	return err;
+	return 0;
 }
 
 static int undefined_gpu_get_temperature(int *temp)
@@ -215,7 +222,64 @@ static int undefined_gpu_get_temperature(int *temp)
 	return -EINVAL;
 }
 
-void gpu_sensors_init(void)
+/*
+ * GPU temperature read through the sensor cache: the GPU poll and the
+ * GPU sampling tasks share a single reading within the cache TTL.
+ */
+static struct {
+	int (*read)(int *temp);
+	pthread_mutex_t lock;
+	/* applied to each reading as it is cached */
+	Filter filter;
+	int temp;
+	int err;
+	unsigned long long usec;
+} gpu_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * Filter the GPU temperature readings, FILTER_*.
+ */
+void gpu_set_filter(int kind)
+{
+	pthread_mutex_lock(&gpu_cache.lock);
+	filter_init(&gpu_cache.filter, kind);
+	pthread_mutex_unlock(&gpu_cache.lock);
+}
+
+static int cached_gpu_get_temperature(int *temp)
+{
+	int err;
+
+	pthread_mutex_lock(&gpu_cache.lock);
+	if ( !sensors_cache_fresh(gpu_cache.usec) ) {
+		gpu_cache.err = gpu_cache.read(&gpu_cache.temp);
+		/* a failure is not cached: the next reader retries */
+		gpu_cache.usec = gpu_cache.err ? 0 : clock_monotonic_usec();
+		if ( !gpu_cache.err )
+			gpu_cache.temp = filter_update(&gpu_cache.filter, gpu_cache.temp);
+	}
+	*temp = gpu_cache.temp;
+	err = gpu_cache.err;
+	pthread_mutex_unlock(&gpu_cache.lock);
+
+	return err;
+}
+
+/* hwmon source of the GPU temperature, see sensors_hwmon_add() */
+static int gpu_hwmon;
+
+static int hwmon_gpu_get_temperature(int *temp)
+{
+	return sensors_hwmon_read(gpu_hwmon, temp);
+}
+
+/*
+ * 'hwmon_sensor' (optional): a hwmon source, CHIP[:LABEL], that takes
+ * precedence over the GPU driver detected.
+ */
+void gpu_sensors_init(const char *hwmon_sensor)
 {
 	const char *name_list;
 
@@ -247,5 +311,16 @@ void gpu_sensors_init(void)
 		/* i915 open source driver */
 		GPU_get_temperature = i915_gpu_get_temperature;
 	}
+
+	if ((hwmon_sensor != NULL) && (hwmon_sensor[0] != '\0')) {
+		gpu_hwmon = sensors_hwmon_add(hwmon_sensor);
+		if (gpu_hwmon >= 0)
+			GPU_get_temperature = hwmon_gpu_get_temperature;
+	}
+
+	if (GPU_get_temperature != undefined_gpu_get_temperature) {
+		gpu_cache.read = GPU_get_temperature;
+		GPU_get_temperature = cached_gpu_get_temperature;
+	}
 }
 
@@ -11,7 +11,8 @@ extern int (*GPU_get_temperature)(int *temp);
 
 
 char *vga_driver_name_list(void);
-void gpu_sensors_init(void);
+void gpu_sensors_init(const char *hwmon_sensor);
+void gpu_set_filter(int kind);
 
 #endif	/* _PCI_TOOLS_H */
 
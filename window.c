@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+/*
+ * Sliding sample window with incremental aggregation.
+ *
+ * The window keeps its samples both in order of arrival and sorted.
+ * Pushing a sample updates the running sum, and moves the sorted array
+ * by one insertion and (once the window is full) one removal. The mean
+ * costs O(1); percentiles (max included) cost O(window length) per sample
+ * pushed, for keeping the array sorted, and are then looked up directly.
+ */
+
+#include <string.h>
+
+#include "window.h"
+
+
+void window_init(SampleWindow *w, int len)
+{
+	memset(w, 0, sizeof(SampleWindow));
+
+	if (len < 1)
+		len = 1;
+	if (len > ATFP_WINDOW_MAX)
+		len = ATFP_WINDOW_MAX;
+	w->len = len;
+}
+
+/* index of the first sorted sample not less than 'sample' */
+static int sorted_lower_bound(SampleWindow *w, int sample)
+{
+	int lo = 0;
+	int hi = w->count;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (w->sorted[mid] < sample)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void window_push(SampleWindow *w, int sample)
+{
+	int oldest;
+	int i;
+
+	if (w->count == w->len) {
+		/* drop the oldest sample */
+		oldest = w->samples[w->head];
+		w->sum -= oldest;
+		i = sorted_lower_bound(w, oldest);
+		memmove(&w->sorted[i], &w->sorted[i + 1], (w->count - i - 1) * sizeof(int));
+		w->count--;
+	}
+
+	w->samples[w->head] = sample;
+	w->head = (w->head + 1) % w->len;
+	w->sum += sample;
+
+	i = sorted_lower_bound(w, sample);
+	memmove(&w->sorted[i + 1], &w->sorted[i], (w->count - i) * sizeof(int));
+	w->sorted[i] = sample;
+	w->count++;
+}
+
+int window_max(SampleWindow *w)
+{
+	return (w->count > 0) ? w->sorted[w->count - 1] : 0;
+}
+
+int window_mean(SampleWindow *w)
+{
+	if (w->count == 0)
+		return 0;
+
+	/* round to nearest */
+	if (w->sum >= 0)
+		return (int)((w->sum + w->count / 2) / w->count);
+	return (int)((w->sum - w->count / 2) / w->count);
+}
+
+/*
+ * Nearest-rank percentile.
+ */
+int window_percentile(SampleWindow *w, int percent)
+{
+	int rank;
+
+	if (w->count == 0)
+		return 0;
+
+	rank = (percent * w->count + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+
+	return w->sorted[rank - 1];
+}
+
+int window_aggregate(SampleWindow *w, int aggregate)
+{
+	switch (aggregate) {
+	case ATFP_AGGREGATE_MEAN:
+		return window_mean(w);
+	case ATFP_AGGREGATE_P95:
+		return window_percentile(w, 95);
+	case ATFP_AGGREGATE_MAX:
+	default:
+		return window_max(w);
+	}
+}
+
+
+/* unit test */
+int window_test(void)
+{
+	SampleWindow w;
+	int i;
+	int err = 0;
+
+	window_init(&w, 4);
+	window_push(&w, 40);
+	window_push(&w, 45);
+	window_push(&w, 41);
+	if ((window_max(&w) != 45) || (window_mean(&w) != 42)) {
+		err = -1;
+		goto test_out;
+	}
+
+	/* a spike is held for the length of the window, then expires */
+	window_push(&w, 70);
+	for (i = 0; i < 3; ++i) {
+		window_push(&w, 40);
+		if (window_max(&w) != 70) {
+			err = -2;
+			goto test_out;
+		}
+	}
+	window_push(&w, 40);
+	if ((window_max(&w) != 40) || (window_mean(&w) != 40)) {
+		err = -3;
+		goto test_out;
+	}
+
+	/* p95 of 1..20 is 19 */
+	window_init(&w, 20);
+	for (i = 20; i >= 1; --i)
+		window_push(&w, i);
+	if ((window_percentile(&w, 95) != 19) || (window_max(&w) != 20) || (window_mean(&w) != 11)) {
+		err = -4;
+		goto test_out;
+	}
+
+test_out:
+	return err;
+}
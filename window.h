@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026, CompuLab ltd.
+ * License: GNU GPLv2 or later, at your option
+ */
+/*
+ * Sliding sample window with incremental aggregation.
+ */
+
+#ifndef _WINDOW_H
+#define _WINDOW_H
+
+#define ATFP_WINDOW_MAX			64
+
+enum {
+	ATFP_AGGREGATE_MAX,
+	ATFP_AGGREGATE_MEAN,
+	ATFP_AGGREGATE_P95,
+};
+
+typedef struct {
+	int len;
+	int count;
+	int head;
+	long sum;
+	/* samples in order of arrival (ring) */
+	int samples[ATFP_WINDOW_MAX];
+	/* the same samples, ascending */
+	int sorted[ATFP_WINDOW_MAX];
+} SampleWindow;
+
+
+void window_init(SampleWindow *w, int len);
+void window_push(SampleWindow *w, int sample);
+int window_max(SampleWindow *w);
+int window_mean(SampleWindow *w);
+int window_percentile(SampleWindow *w, int percent);
+int window_aggregate(SampleWindow *w, int aggregate);
+
+int window_test(void);
+
+#endif	/* _WINDOW_H */